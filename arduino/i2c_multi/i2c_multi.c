@@ -1,312 +1,793 @@
 #include "i2c_multi.h"
 
+#include "hardware/clocks.h"
 #include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "i2c_multi_handler.h"
+#include "pico/stdio.h"
+#include <string.h>
 
 #define CLK_DIV 16
+#define SCL_PERIOD_CYCLES 16  // PIO cycles per SCL period at the set bus speed. Transfers fail below 11 to 14
+#define START_CONDITION_COUNT 0xFFFFFFFF
+#define TRACE_MAGIC "I2CT"
+#define TRACE_VERSION 1
+#define PEC_POLYNOMIAL 0x07  // CRC-8 of SMBus, x^8 + x^2 + x + 1
 
-static i2c_multi_t *i2c_multi;
+i2c_multi_t i2c_multi_instance[NUM_PIOS];
+static uint8_t core1_instances;  // bit per PIO index, the interrupts of these instances are enabled on core1
+static bool core1_launched;      // core1 runs core1_entry
+uint8_t i2c_multi_crc8_table[256];
+static uint8_t write_pad = 0xFF;  // read by the pad DMA channel, in RAM to stay off the flash cache
 
-static void (*receive_handler)(uint8_t data, bool is_address) = NULL;
-static void (*request_handler)(uint8_t address) = NULL;
-static void (*stop_handler)(uint8_t length) = NULL;
+// transfer_byte without the write path at its end: master reads are nacked and 9 instructions are left free
+static const pio_program_t transfer_byte_receive_program = {
+    .instructions = transfer_byte_program_instructions,
+    .length = transfer_byte_offset_write,
+    .origin = 0,
+};
 
-static inline void start_condition_program_init(PIO pio, uint sm, uint offset, uint pin);
-static inline void stop_condition_program_init(PIO pio, uint sm, uint offset, uint pin);
-static inline void read_byte_program_init(PIO pio, uint sm, uint offset, uint pin);
-static inline void write_byte_program_init(PIO pio, uint sm, uint offset, uint pin);
-static inline void byte_handler_pio(void);
-static inline void stop_handler_pio(void);
-static inline uint8_t transpond_byte(uint8_t byte);
+static i2c_multi_t *init(PIO pio, uint pin, bool receive_only);
+static void sniffer_remove(i2c_multi_t *i2c_multi);
+static inline void bus_condition_program_init(i2c_multi_t *i2c_multi, PIO pio, uint sm, uint offset, uint pin);
+static inline void transfer_byte_program_init(PIO pio, uint sm, uint offset, uint pin);
+static inline void sniff_byte_program_init(i2c_multi_t *i2c_multi, PIO pio, uint sm, uint offset, uint pin);
+static void byte_handler_pio0(void);
+static void byte_handler_pio1(void);
+static void stop_handler_pio0(void);
+static void stop_handler_pio1(void);
+static void core1_entry(void);
+static void fifo_handler(void);
+static inline uint16_t bus_divider(uint32_t scl_hz);
+static inline void dispatch_device(i2c_multi_t *i2c_multi, uint64_t event);
+static void crc8_table_init(void);
+#ifdef I2C_MULTI_STATS
+static inline void stats_systick_start(void);
+#endif
 
-void i2c_multi_init(PIO pio, uint pin) {
-    i2c_multi = (i2c_multi_t *)malloc(sizeof(i2c_multi_t));
+i2c_multi_t *i2c_multi_init(PIO pio, uint pin) { return init(pio, pin, false); }
+
+i2c_multi_t *i2c_multi_init_receive_only(PIO pio, uint pin) { return init(pio, pin, true); }
+
+static i2c_multi_t *init(PIO pio, uint pin, bool receive_only) {
+    i2c_multi_t *i2c_multi = &i2c_multi_instance[pio_get_index(pio)];
+    // One instance per PIO, a slave or sniffer still running on it is not taken over
+    if (i2c_multi->pio) return NULL;
+    // Nothing is left from an instance removed before, only the fields not starting at zero are set
+    memset(i2c_multi, 0, sizeof(i2c_multi_t));
     i2c_multi->pio = pio;
-    i2c_multi->status = I2C_IDLE;
+    i2c_multi->receive_only = receive_only;
+    i2c_multi->lock = spin_lock_instance(spin_lock_claim_unused(true));
     i2c_multi->pin = pin;
-    i2c_multi->bytes_count = 0;
-    i2c_multi_disable_all_addresses();
-    i2c_multi->buffer = NULL;
-    i2c_multi->buffer_start = NULL;
+    i2c_multi->matched_10bit = ADDRESS_10BIT_NONE;
+    i2c_multi->clkdiv = CLK_DIV;
+    crc8_table_init();
+#ifdef I2C_MULTI_STATS
+    i2c_multi_clear_stats(i2c_multi);
+    stats_systick_start();
+#endif
     uint pio_irq0 = (pio == pio0 ? PIO0_IRQ_0 : PIO1_IRQ_0);
     uint pio_irq1 = (pio == pio0 ? PIO0_IRQ_1 : PIO1_IRQ_1);
     i2c_multi->length = -1;
-    pio_gpio_init(pio, pin);
-    pio_gpio_init(pio, pin + 1);
-    i2c_multi->offset_start = pio_add_program(pio, &start_condition_program);
-    i2c_multi->sm_start = pio_claim_unused_sm(pio, true);
-    start_condition_program_init(pio, i2c_multi->sm_start, i2c_multi->offset_start, pin);
-    i2c_multi->offset_stop = pio_add_program(pio, &stop_condition_program);
-    i2c_multi->sm_stop = pio_claim_unused_sm(pio, true);
-    stop_condition_program_init(pio, i2c_multi->sm_stop, i2c_multi->offset_stop, pin);
-    i2c_multi->offset_read = pio_add_program(pio, &read_byte_program);
-    i2c_multi->sm_read = pio_claim_unused_sm(pio, true);
-    read_byte_program_init(pio, i2c_multi->sm_read, i2c_multi->offset_read, pin);
-    i2c_multi->offset_write = pio_add_program(pio, &write_byte_program);
-    i2c_multi->sm_write = pio_claim_unused_sm(pio, true);
-    write_byte_program_init(pio, i2c_multi->sm_write, i2c_multi->offset_write, pin);
-    pio_sm_put(pio, i2c_multi->sm_read,
-               (((uint32_t)do_ack_program_instructions[1]) << 16) | do_ack_program_instructions[0]);
-    pio_sm_put(pio, i2c_multi->sm_read,
-               (((uint32_t)do_ack_program_instructions[3]) << 16) | do_ack_program_instructions[2]);
-    irq_set_exclusive_handler(pio_irq0, byte_handler_pio);
+    i2c_multi->transfer_length = -1;
+    i2c_multi->offset =
+        pio_add_program(pio, receive_only ? &transfer_byte_receive_program : &transfer_byte_program);
+    i2c_multi->sm = pio_claim_unused_sm(pio, true);
+    i2c_multi->jmp_ack = pio_encode_jmp(i2c_multi->offset + transfer_byte_offset_ack);
+    i2c_multi->jmp_idle = pio_encode_jmp(i2c_multi->offset + transfer_byte_offset_idle);
+    transfer_byte_program_init(pio, i2c_multi->sm, i2c_multi->offset, pin);
+    i2c_multi->offset_bus = pio_add_program(pio, &bus_condition_program);
+    i2c_multi->sm_bus = pio_claim_unused_sm(pio, true);
+    bus_condition_program_init(i2c_multi, pio, i2c_multi->sm_bus, i2c_multi->offset_bus, pin);
+    // transfer_byte is loaded at offset 0 and uses the PIO interrupt flags 0 and 1
+    irq_set_exclusive_handler(pio_irq0, pio == pio0 ? byte_handler_pio0 : byte_handler_pio1);
     irq_set_enabled(pio_irq0, true);
-    irq_set_exclusive_handler(pio_irq1, stop_handler_pio);
+    irq_set_exclusive_handler(pio_irq1, pio == pio0 ? stop_handler_pio0 : stop_handler_pio1);
     irq_set_enabled(pio_irq1, true);
+    return i2c_multi;
 }
 
-void i2c_multi_set_write_buffer(uint8_t *buffer) {
+i2c_multi_t *i2c_multi_init_sniffer(PIO pio, uint pin, uint16_t *ring, uint8_t size_bits) {
+    i2c_multi_t *i2c_multi = &i2c_multi_instance[pio_get_index(pio)];
+    if (i2c_multi->pio) return NULL;
+    memset(i2c_multi, 0, sizeof(i2c_multi_t));
+    i2c_multi->pio = pio;
+    // Only for the address setters, which the sniffer does not use but may be given
+    i2c_multi->lock = spin_lock_instance(spin_lock_claim_unused(true));
+    i2c_multi->pin = pin;
+    i2c_multi->status = I2C_IDLE;
+    i2c_multi->sniffer_ring = ring;
+    i2c_multi->sniffer_ring_bits = size_bits;
+    i2c_multi->clkdiv = CLK_DIV;
+    i2c_multi->offset = pio_add_program(pio, &sniff_byte_program);
+    i2c_multi->sm = pio_claim_unused_sm(pio, true);
+    sniff_byte_program_init(i2c_multi, pio, i2c_multi->sm, i2c_multi->offset, pin);
+    i2c_multi->offset_bus = pio_add_program(pio, &bus_condition_program);
+    i2c_multi->sm_bus = pio_claim_unused_sm(pio, true);
+    bus_condition_program_init(i2c_multi, pio, i2c_multi->sm_bus, i2c_multi->offset_bus, pin);
+    // The sniffer is only fed by DMA, the PIO interrupts are left disabled
+    pio_set_irq1_source_enabled(pio, pis_interrupt1, false);
+    return i2c_multi;
+}
+
+void i2c_multi_set_write_buffer(i2c_multi_t *i2c_multi, uint8_t *buffer) {
     i2c_multi->buffer = buffer;
     i2c_multi->buffer_start = buffer;
 }
 
-void i2c_multi_set_receive_handler(i2c_multi_receive_handler_t handler) { receive_handler = handler; }
+void i2c_multi_set_back_buffer(i2c_multi_t *i2c_multi, uint8_t *buffer) { i2c_multi->buffer_back = buffer; }
+
+// The interrupt reads the front buffer and latches it in one step under the instance lock when it runs on core1, so
+// a swap on core0 lands either before the latch or after it. On a single core the lock keeps the interrupt out
+uint8_t *i2c_multi_get_back_buffer(i2c_multi_t *i2c_multi) {
+    uint32_t save = spin_lock_blocking(i2c_multi->lock);
+    // Still being sent by a read that latched it before the last swap
+    uint8_t *back = i2c_multi->buffer_back;
+    if (back == i2c_multi->buffer_latched) back = NULL;
+    spin_unlock(i2c_multi->lock, save);
+    return back;
+}
+
+void i2c_multi_swap_buffers(i2c_multi_t *i2c_multi) {
+    uint32_t save = spin_lock_blocking(i2c_multi->lock);
+    uint8_t *front = i2c_multi->buffer_start;
+    i2c_multi->buffer_start = i2c_multi->buffer_back;
+    i2c_multi->buffer_back = front;
+    spin_unlock(i2c_multi->lock, save);
+}
+
+void i2c_multi_set_address_buffer(i2c_multi_t *i2c_multi, uint8_t address, uint8_t *buffer, int32_t length) {
+    i2c_multi->address_buffer[address & 0x7F] = buffer;
+    i2c_multi->address_length[address & 0x7F] = length;
+}
+
+void i2c_multi_set_register_map(i2c_multi_t *i2c_multi, uint8_t address, uint8_t *registers, uint16_t size) {
+    // The handlers wrap the pointer at the size, an empty map leaves register map mode. Reads have no length until
+    // one is set, so the PEC is off until it is set again
+    i2c_multi->register_map[address & 0x7F] = size ? registers : NULL;
+    i2c_multi->register_size[address & 0x7F] = size;
+    i2c_multi->register_pointer[address & 0x7F] = 0;
+    i2c_multi->register_read_length[address & 0x7F] = 0;
+    i2c_multi->pec[address & 0x7F] = false;
+}
+
+void i2c_multi_set_register_read_length(i2c_multi_t *i2c_multi, uint8_t address, uint16_t length) {
+    i2c_multi->register_read_length[address & 0x7F] = length;
+    if (!length) i2c_multi->pec[address & 0x7F] = false;
+}
+
+void i2c_multi_set_receive_buffer(i2c_multi_t *i2c_multi, uint8_t address, uint8_t *buffer, uint16_t size) {
+    i2c_multi->receive_buffer[address & 0x7F] = buffer;
+    i2c_multi->receive_size[address & 0x7F] = size;
+}
 
-void i2c_multi_set_request_handler(i2c_multi_request_handler_t handler) { request_handler = handler; }
+void i2c_multi_set_stream(i2c_multi_t *i2c_multi, uint8_t address, uint8_t *chunks, uint16_t chunk_size) {
+    // Streams have no end to check or send a PEC at
+    if (chunks) i2c_multi->pec[address & 0x7F] = false;
+    i2c_multi->stream[address & 0x7F] = chunks;
+    i2c_multi->stream_size[address & 0x7F] = chunk_size;
+    i2c_multi->stream_position[address & 0x7F] = 0;
+}
 
-void i2c_multi_set_stop_handler(i2c_multi_stop_handler_t handler) { stop_handler = handler; }
+bool i2c_multi_set_pec(i2c_multi_t *i2c_multi, uint8_t address, bool enabled) {
+    // The PEC of a read is sent after its length: refused where reads go on until the master nacks
+    address &= 0x7F;
+    if (enabled && (i2c_multi->stream[address] ||
+                    (i2c_multi->register_map[address] && !i2c_multi->register_read_length[address])))
+        return false;
+    i2c_multi->pec[address] = enabled;
+    return true;
+}
 
-void i2c_multi_enable_address(uint8_t address) { i2c_multi->address[address / 32] |= 1 << (address % 32); }
+void i2c_multi_set_device(i2c_multi_t *i2c_multi, uint8_t address, const i2c_multi_device_t *device, void *context) {
+    i2c_multi->context[address & 0x7F] = context;
+    i2c_multi->device[address & 0x7F] = device;
+}
 
-void i2c_multi_disable_address(uint8_t address) { i2c_multi->address[address / 32] &= ~(1 << (address % 32)); }
+void i2c_multi_set_receive_handler(i2c_multi_t *i2c_multi, i2c_multi_receive_handler_t handler) {
+    i2c_multi->receive_handler = handler;
+}
 
-void i2c_multi_enable_all_addresses() {
+void i2c_multi_set_request_handler(i2c_multi_t *i2c_multi, i2c_multi_request_handler_t handler) {
+    i2c_multi->request_handler = handler;
+}
+
+void i2c_multi_set_stop_handler(i2c_multi_t *i2c_multi, i2c_multi_stop_handler_t handler) {
+    i2c_multi->stop_handler = handler;
+}
+
+void i2c_multi_set_repeated_start_handler(i2c_multi_t *i2c_multi, i2c_multi_repeated_start_handler_t handler) {
+    i2c_multi->repeated_start_handler = handler;
+}
+
+void i2c_multi_set_receive_buffer_handler(i2c_multi_t *i2c_multi, i2c_multi_receive_buffer_handler_t handler) {
+    i2c_multi->receive_buffer_handler = handler;
+}
+
+void i2c_multi_set_address_10bit_handler(i2c_multi_t *i2c_multi, i2c_multi_address_10bit_handler_t handler) {
+    i2c_multi->address_10bit_handler = handler;
+}
+
+void i2c_multi_set_stream_handler(i2c_multi_t *i2c_multi, i2c_multi_stream_handler_t handler) {
+    i2c_multi->stream_handler = handler;
+}
+
+void i2c_multi_set_pec_error_handler(i2c_multi_t *i2c_multi, i2c_multi_pec_error_handler_t handler) {
+    i2c_multi->pec_error_handler = handler;
+}
+
+// The bitmaps are read by the handlers on either core. A set or clear is a read-modify-write, which the M0+ can only
+// make atomic with a hardware spin lock, so two cores enabling addresses in the same word do not lose one
+void i2c_multi_enable_address(i2c_multi_t *i2c_multi, uint8_t address) {
+    uint32_t save = spin_lock_blocking(i2c_multi->lock);
+    i2c_multi->address[address / 32] |= 1 << (address % 32);
+    spin_unlock(i2c_multi->lock, save);
+}
+
+void i2c_multi_disable_address(i2c_multi_t *i2c_multi, uint8_t address) {
+    uint32_t save = spin_lock_blocking(i2c_multi->lock);
+    i2c_multi->address[address / 32] &= ~(1 << (address % 32));
+    spin_unlock(i2c_multi->lock, save);
+}
+
+// Under the lock as well, so a set or clear of a single address on the other core is not undone halfway
+void i2c_multi_enable_all_addresses(i2c_multi_t *i2c_multi) {
+    uint32_t save = spin_lock_blocking(i2c_multi->lock);
     i2c_multi->address[0] = 0xFFFFFFFF;
     i2c_multi->address[1] = 0xFFFFFFFF;
     i2c_multi->address[2] = 0xFFFFFFFF;
     i2c_multi->address[3] = 0xFFFFFFFF;
+    spin_unlock(i2c_multi->lock, save);
 }
 
-void i2c_multi_disable_all_addresses() {
+void i2c_multi_disable_all_addresses(i2c_multi_t *i2c_multi) {
+    uint32_t save = spin_lock_blocking(i2c_multi->lock);
     i2c_multi->address[0] = 0;
     i2c_multi->address[1] = 0;
     i2c_multi->address[2] = 0;
     i2c_multi->address[3] = 0;
+    spin_unlock(i2c_multi->lock, save);
 }
 
-bool i2c_multi_is_address_enabled(uint8_t address) { return i2c_multi->address[address / 32] & (1 << (address % 32)); }
+bool i2c_multi_is_address_enabled(i2c_multi_t *i2c_multi, uint8_t address) {
+    return address_enabled(i2c_multi, address);
+}
 
-void i2c_multi_disable(void) {
-    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_read, false);
-    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_write, false);
-    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_start, false);
-    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_stop, false);
-    pio_sm_clear_fifos(i2c_multi->pio, i2c_multi->sm_read);
-    pio_sm_clear_fifos(i2c_multi->pio, i2c_multi->sm_write);
+void i2c_multi_enable_address_10bit(i2c_multi_t *i2c_multi, uint16_t address) {
+    uint32_t save = spin_lock_blocking(i2c_multi->lock);
+    i2c_multi->address_10bit[(address & 0x3FF) / 32] |= 1u << (address % 32);
+    spin_unlock(i2c_multi->lock, save);
+}
+
+void i2c_multi_disable_address_10bit(i2c_multi_t *i2c_multi, uint16_t address) {
+    uint32_t save = spin_lock_blocking(i2c_multi->lock);
+    i2c_multi->address_10bit[(address & 0x3FF) / 32] &= ~(1u << (address % 32));
+    spin_unlock(i2c_multi->lock, save);
+}
+
+bool i2c_multi_is_address_10bit_enabled(i2c_multi_t *i2c_multi, uint16_t address) {
+    return address_10bit_enabled(i2c_multi, address);
+}
+
+void i2c_multi_disable(i2c_multi_t *i2c_multi) {
+    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm, false);
+    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_bus, false);
+    pio_sm_clear_fifos(i2c_multi->pio, i2c_multi->sm);
+    // Release both lines, which may have been held by the state machine
+    pio_sm_set_pindirs_with_mask(i2c_multi->pio, i2c_multi->sm, 1u << i2c_multi->pin, 3u << i2c_multi->pin);
     gpio_set_input_enabled(i2c_multi->pin, true);
     gpio_set_input_enabled(i2c_multi->pin + 1, true);
+    if (i2c_multi->receive_ring) dma_channel_abort(i2c_multi->dma_receive);
+    if (i2c_multi->write_dma) {
+        dma_channel_abort(i2c_multi->dma_write);
+        dma_channel_abort(i2c_multi->dma_pad);
+        i2c_multi->write_dma_busy = false;
+    }
+    pio_set_irq0_source_enabled(i2c_multi->pio, (pio_interrupt_source_t)(pis_sm0_rx_fifo_not_empty + i2c_multi->sm),
+                                true);
+    pio_set_irq0_source_enabled(i2c_multi->pio, (pio_interrupt_source_t)(pis_sm0_tx_fifo_not_full + i2c_multi->sm),
+                                false);
+    pio_set_irq0_source_enabled(i2c_multi->pio, pis_interrupt0, false);
+    i2c_multi->receive_ring_busy = false;
+    if (i2c_multi->hs_active) hs_mode_end(i2c_multi);
+    i2c_multi->matched_10bit = ADDRESS_10BIT_NONE;
+    i2c_multi->prefix_10bit = 0;
+    i2c_multi->pec_active = false;
+    i2c_multi->pec_continue = false;
     i2c_multi->bytes_count = 0;
     i2c_multi->status = I2C_IDLE;
     i2c_multi->buffer = i2c_multi->buffer_start;
+    i2c_multi->buffer_end = NULL;
+    i2c_multi->buffer_latched = NULL;
+    i2c_multi->registers = NULL;
+    i2c_multi->register_held = 0;
+    i2c_multi->streamed = NULL;
 }
 
-void i2c_multi_restart(void) {
-    i2c_multi_disable();
-    pio_sm_restart(i2c_multi->pio, i2c_multi->sm_start);
-    pio_sm_restart(i2c_multi->pio, i2c_multi->sm_stop);
-    pio_sm_restart(i2c_multi->pio, i2c_multi->sm_read);
-    pio_sm_restart(i2c_multi->pio, i2c_multi->sm_write);
-    pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-               (((uint32_t)do_ack_program_instructions[1]) << 16) | do_ack_program_instructions[0]);
-    pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-               (((uint32_t)do_ack_program_instructions[3]) << 16) | do_ack_program_instructions[2]);
-    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_read, true);
-    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_write, true);
-    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_start, true);
-    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_stop, true);
-}
-
-void i2c_multi_remove(void) {
-    receive_handler = NULL;
-    request_handler = NULL;
-    stop_handler = NULL;
+void i2c_multi_restart(i2c_multi_t *i2c_multi) {
+    i2c_multi_disable(i2c_multi);
+    pio_sm_restart(i2c_multi->pio, i2c_multi->sm_bus);
+    pio_sm_restart(i2c_multi->pio, i2c_multi->sm);
+    pio_sm_exec(i2c_multi->pio, i2c_multi->sm_bus,
+                pio_encode_jmp(i2c_multi->offset_bus + bus_condition_offset_start));
+    pio_sm_exec(i2c_multi->pio, i2c_multi->sm, i2c_multi->jmp_idle);
+    pio_sm_clear_fifos(i2c_multi->pio, i2c_multi->sm_bus);
+    pio_interrupt_clear(i2c_multi->pio, 0);
+    pio_interrupt_clear(i2c_multi->pio, 1);
+    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm, true);
+    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_bus, true);
+}
+
+void i2c_multi_remove(i2c_multi_t *i2c_multi) {
+    if (i2c_multi->sniffer_ring) {
+        sniffer_remove(i2c_multi);
+        return;
+    }
+    i2c_multi_set_core1(i2c_multi, false);
+    i2c_multi->receive_handler = NULL;
+    i2c_multi->request_handler = NULL;
+    i2c_multi->stop_handler = NULL;
+    i2c_multi->repeated_start_handler = NULL;
+    i2c_multi->receive_buffer_handler = NULL;
+    i2c_multi->address_10bit_handler = NULL;
+    i2c_multi->stream_handler = NULL;
+    i2c_multi->pec_error_handler = NULL;
+    for (uint i = 0; i < 128; i++) i2c_multi->device[i] = NULL;
+    i2c_multi_set_receive_ring(i2c_multi, NULL, 0);
+    i2c_multi_set_write_dma(i2c_multi, false);
     uint pio_irq0 = (i2c_multi->pio == pio0 ? PIO0_IRQ_0 : PIO1_IRQ_0);
     uint pio_irq1 = (i2c_multi->pio == pio0 ? PIO0_IRQ_1 : PIO1_IRQ_1);
     irq_set_enabled(pio_irq0, false);
     irq_set_enabled(pio_irq1, false);
+    // The handlers may be the ones of the C++ front end, the next init sets its own
+    irq_remove_handler(pio_irq0, irq_get_exclusive_handler(pio_irq0));
+    irq_remove_handler(pio_irq1, irq_get_exclusive_handler(pio_irq1));
+    pio_set_irq0_source_enabled(i2c_multi->pio, (pio_interrupt_source_t)(pis_sm0_rx_fifo_not_empty + i2c_multi->sm),
+                                false);
+    pio_set_irq0_source_enabled(i2c_multi->pio, (pio_interrupt_source_t)(pis_sm0_tx_fifo_not_full + i2c_multi->sm),
+                                false);
     pio_set_irq0_source_enabled(i2c_multi->pio, pis_interrupt0, false);
     pio_set_irq1_source_enabled(i2c_multi->pio, pis_interrupt1, false);
-    pio_clear_instruction_memory(i2c_multi->pio);
-    pio_sm_unclaim(i2c_multi->pio, i2c_multi->sm_start);
-    pio_sm_unclaim(i2c_multi->pio, i2c_multi->sm_stop);
-    pio_sm_unclaim(i2c_multi->pio, i2c_multi->sm_read);
-    pio_sm_unclaim(i2c_multi->pio, i2c_multi->sm_write);
+    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm, false);
+    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_bus, false);
+    dma_channel_abort(i2c_multi->dma_start_condition);
+    dma_channel_unclaim(i2c_multi->dma_start_condition);
+    // Give SDA its normal output enable back without driving it low on the way
+    gpio_set_oeover(i2c_multi->pin, GPIO_OVERRIDE_LOW);
+    pio_sm_set_pindirs_with_mask(i2c_multi->pio, i2c_multi->sm, 0, 3u << i2c_multi->pin);
+    gpio_set_oeover(i2c_multi->pin, GPIO_OVERRIDE_NORMAL);
+    pio_remove_program(i2c_multi->pio,
+                       i2c_multi->receive_only ? &transfer_byte_receive_program : &transfer_byte_program,
+                       i2c_multi->offset);
+    pio_remove_program(i2c_multi->pio, &bus_condition_program, i2c_multi->offset_bus);
+    pio_sm_unclaim(i2c_multi->pio, i2c_multi->sm);
+    pio_sm_unclaim(i2c_multi->pio, i2c_multi->sm_bus);
+    spin_lock_unclaim(spin_lock_get_num(i2c_multi->lock));
     i2c_multi->buffer = NULL;
     i2c_multi->buffer_start = NULL;
     i2c_multi->bytes_count = 0;
     i2c_multi->status = I2C_IDLE;
     gpio_set_input_enabled(i2c_multi->pin, true);
     gpio_set_input_enabled(i2c_multi->pin + 1, true);
-    free(i2c_multi);
+    i2c_multi->pio = NULL;
 }
 
-void i2c_multi_fixed_length(int16_t length) { i2c_multi->length = length; }
+static void sniffer_remove(i2c_multi_t *i2c_multi) {
+    // The lines were never taken from their function, so only the PIO and DMA resources are given back
+    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm, false);
+    pio_sm_set_enabled(i2c_multi->pio, i2c_multi->sm_bus, false);
+    dma_channel_abort(i2c_multi->dma_start_condition);
+    dma_channel_unclaim(i2c_multi->dma_start_condition);
+    dma_channel_abort(i2c_multi->dma_receive);
+    dma_channel_unclaim(i2c_multi->dma_receive);
+    pio_remove_program(i2c_multi->pio, &sniff_byte_program, i2c_multi->offset);
+    pio_remove_program(i2c_multi->pio, &bus_condition_program, i2c_multi->offset_bus);
+    pio_sm_unclaim(i2c_multi->pio, i2c_multi->sm);
+    pio_sm_unclaim(i2c_multi->pio, i2c_multi->sm_bus);
+    spin_lock_unclaim(spin_lock_get_num(i2c_multi->lock));
+    i2c_multi->pio = NULL;
+}
 
-static inline void start_condition_program_init(PIO pio, uint sm, uint offset, uint pin) {
-    pio_sm_config c = start_condition_program_get_default_config(offset);
-    sm_config_set_in_pins(&c, pin);
-    sm_config_set_clkdiv(&c, CLK_DIV);
-    sm_config_set_jmp_pin(&c, pin + 1);
-    pio_sm_init(pio, sm, offset + start_condition_offset_start, &c);
-    pio_sm_set_enabled(pio, sm, true);
+void i2c_multi_fixed_length(i2c_multi_t *i2c_multi, int32_t length) { i2c_multi->length = length; }
+
+uint16_t i2c_multi_set_bus_speed(i2c_multi_t *i2c_multi, uint32_t scl_hz) {
+    i2c_multi->clkdiv = bus_divider(scl_hz);
+    if (!i2c_multi->hs_active) set_clkdiv(i2c_multi, i2c_multi->clkdiv);
+    return i2c_multi->clkdiv;
+}
+
+uint16_t i2c_multi_set_hs_speed(i2c_multi_t *i2c_multi, uint32_t scl_hz) {
+    i2c_multi->hs_clkdiv = scl_hz ? bus_divider(scl_hz) : 0;
+    return i2c_multi->hs_clkdiv;
 }
 
-static inline void stop_condition_program_init(PIO pio, uint sm, uint offset, uint pin) {
-    pio_sm_config c = stop_condition_program_get_default_config(offset);
+void i2c_multi_set_receive_ring(i2c_multi_t *i2c_multi, uint8_t *ring, uint8_t size_bits) {
+    if (i2c_multi->receive_ring) {
+        dma_channel_abort(i2c_multi->dma_receive);
+        dma_channel_unclaim(i2c_multi->dma_receive);
+    }
+    i2c_multi->receive_ring = ring;
+    if (!ring) return;
+    i2c_multi->receive_ring_bits = size_bits;
+    i2c_multi->dma_receive = dma_claim_unused_channel(true);
+
+    // Data bytes: RX FIFO -> ring. Started after the address, which is still read by the CPU
+    dma_channel_config c = dma_channel_get_default_config(i2c_multi->dma_receive);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, size_bits);
+    channel_config_set_dreq(&c, pio_get_dreq(i2c_multi->pio, i2c_multi->sm, false));
+    dma_channel_configure(i2c_multi->dma_receive, &c, ring, &i2c_multi->pio->rxf[i2c_multi->sm], RECEIVE_RING_COUNT,
+                          false);
+}
+
+void i2c_multi_set_write_dma(i2c_multi_t *i2c_multi, bool enabled) {
+    if (i2c_multi->write_dma) {
+        dma_channel_abort(i2c_multi->dma_write);
+        dma_channel_abort(i2c_multi->dma_pad);
+        dma_channel_unclaim(i2c_multi->dma_write);
+        dma_channel_unclaim(i2c_multi->dma_pad);
+        i2c_multi->write_dma_busy = false;
+    }
+    i2c_multi->write_dma = enabled;
+    if (!enabled) return;
+    i2c_multi->dma_write = dma_claim_unused_channel(true);
+    i2c_multi->dma_pad = dma_claim_unused_channel(true);
+
+    // Write buffer -> TX FIFO, paced by the state machine pulling one byte per master ack. The byte is replicated to
+    // all lanes of the FIFO word, so the state machine finds it in the top bits already in bus order
+    dma_channel_config c = dma_channel_get_default_config(i2c_multi->dma_write);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(i2c_multi->pio, i2c_multi->sm, true));
+    channel_config_set_chain_to(&c, i2c_multi->dma_pad);
+    dma_channel_configure(i2c_multi->dma_write, &c, &i2c_multi->pio->txf[i2c_multi->sm], NULL, 0, false);
+
+    // 0xFF after a fixed length, the state machine holds SCL on an empty FIFO until the master nacks
+    c = dma_channel_get_default_config(i2c_multi->dma_pad);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(i2c_multi->pio, i2c_multi->sm, true));
+    dma_channel_configure(i2c_multi->dma_pad, &c, &i2c_multi->pio->txf[i2c_multi->sm], &write_pad, WRITE_DMA_COUNT,
+                          false);
+}
+
+// The handlers are shared by both cores and only one of them may enable the interrupts of an instance: core0 lets
+// them go here, then core1 takes them with i2c_multi_enable_core1_irq()
+void i2c_multi_prepare_core1(i2c_multi_t *i2c_multi, bool enabled) {
+    if (enabled == i2c_multi->core1) return;
+    uint pio_irq0 = (i2c_multi->pio == pio0 ? PIO0_IRQ_0 : PIO1_IRQ_0);
+    uint pio_irq1 = (i2c_multi->pio == pio0 ? PIO0_IRQ_1 : PIO1_IRQ_1);
+    // Queued events are announced through the FIFO from core1, and core0 runs the handlers from its FIFO interrupt
+    if (!core1_instances) {
+        irq_add_shared_handler(SIO_IRQ_PROC0, fifo_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(SIO_IRQ_PROC0, true);
+    }
+    i2c_multi->core1 = enabled;
+    if (enabled)
+        core1_instances |= 1u << pio_get_index(i2c_multi->pio);
+    else
+        core1_instances &= ~(1u << pio_get_index(i2c_multi->pio));
+    if (!core1_instances) {
+        irq_remove_handler(SIO_IRQ_PROC0, fifo_handler);
+        // Left enabled for the other handlers of the application
+        if (!irq_has_shared_handler(SIO_IRQ_PROC0)) irq_set_enabled(SIO_IRQ_PROC0, false);
+    }
+    irq_set_enabled(pio_irq0, !enabled);
+    irq_set_enabled(pio_irq1, !enabled);
+}
+
+void __not_in_flash_func(i2c_multi_enable_core1_irq)(i2c_multi_t *i2c_multi, bool enabled) {
+#ifdef I2C_MULTI_STATS
+    // Each core has its own SysTick, the handlers sample the one of core1
+    if (enabled) stats_systick_start();
+#endif
+    irq_set_enabled(i2c_multi->pio == pio0 ? PIO0_IRQ_0 : PIO1_IRQ_0, enabled);
+    irq_set_enabled(i2c_multi->pio == pio0 ? PIO0_IRQ_1 : PIO1_IRQ_1, enabled);
+}
+
+// core1 is reset only when it runs the loop launched here, never under code of the application
+void i2c_multi_set_core1(i2c_multi_t *i2c_multi, bool enabled) {
+    if (enabled == i2c_multi->core1) return;
+    // Released by core1 before core0 takes them again
+    if (core1_launched) multicore_reset_core1();
+    i2c_multi_prepare_core1(i2c_multi, enabled);
+    core1_launched = core1_instances;
+    if (core1_launched) {
+        multicore_launch_core1(core1_entry);
+        // The launch drains the FIFO, announcements may have been lost
+        irq_set_pending(SIO_IRQ_PROC0);
+    }
+}
+
+void i2c_multi_arm_response(i2c_multi_t *i2c_multi, uint8_t address, uint8_t *buffer) {
+    i2c_multi->response[address & 0x7F] = buffer;
+}
+
+uint16_t i2c_multi_get_receive_ring_head(i2c_multi_t *i2c_multi) {
+    if (!i2c_multi->receive_ring) return 0;
+    return (dma_channel_hw_addr(i2c_multi->dma_receive)->write_addr - (uintptr_t)i2c_multi->receive_ring) &
+           ((1 << i2c_multi->receive_ring_bits) - 1);
+}
+
+uint16_t i2c_multi_get_sniffer_head(i2c_multi_t *i2c_multi) {
+    if (!i2c_multi->sniffer_ring) return 0;
+    return ((dma_channel_hw_addr(i2c_multi->dma_receive)->write_addr - (uintptr_t)i2c_multi->sniffer_ring) >> 1) &
+           ((1 << i2c_multi->sniffer_ring_bits) - 1);
+}
+
+void i2c_multi_set_event_queue(i2c_multi_t *i2c_multi, uint64_t *queue, uint8_t size_bits) {
+    i2c_multi->event_queue = NULL;
+    i2c_multi->event_head = 0;
+    i2c_multi->event_tail = 0;
+    i2c_multi->event_mask = (1 << size_bits) - 1;
+    i2c_multi->event_queue = queue;
+}
+
+void i2c_multi_task(i2c_multi_t *i2c_multi) {
+    while (i2c_multi->event_tail != i2c_multi->event_head) {
+        __sync_synchronize();
+        uint64_t event = i2c_multi->event_queue[i2c_multi->event_tail];
+        __sync_synchronize();
+        i2c_multi->event_tail = (i2c_multi->event_tail + 1) & i2c_multi->event_mask;
+        i2c_multi_dispatch(i2c_multi, event);
+    }
+}
+
+uint32_t i2c_multi_get_dropped_events(i2c_multi_t *i2c_multi) { return i2c_multi->events_dropped; }
+
+void i2c_multi_set_trace(i2c_multi_t *i2c_multi, i2c_multi_trace_t *buffer, uint8_t size_bits) {
+    i2c_multi->trace = NULL;
+    i2c_multi->trace_head = 0;
+    i2c_multi->trace_mask = (1 << size_bits) - 1;
+    i2c_multi->trace = buffer;
+}
+
+void i2c_multi_dump_trace(i2c_multi_t *i2c_multi) {
+    // Header: magic, version, reserved byte and entry count, then the entries from the oldest. Recording is paused
+    // meanwhile, raw output keeps the stdio CRLF translation out of the binary
+    i2c_multi_trace_t *trace = i2c_multi->trace;
+    i2c_multi->trace = NULL;
+    uint32_t head = i2c_multi->trace_head;
+    uint16_t count = trace ? (head > i2c_multi->trace_mask ? i2c_multi->trace_mask + 1u : head) : 0;
+    const uint8_t header[8] = {TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3],
+                               TRACE_VERSION,  0,              count & 0xFF,   count >> 8};
+    for (uint i = 0; i < sizeof(header); i++) putchar_raw(header[i]);
+    for (uint32_t i = head - count; i != head; i++) {
+        const uint8_t *entry = (const uint8_t *)&trace[i & i2c_multi->trace_mask];
+        for (uint j = 0; j < sizeof(i2c_multi_trace_t); j++) putchar_raw(entry[j]);
+    }
+    i2c_multi->trace = trace;
+}
+
+#ifdef I2C_MULTI_STATS
+const i2c_multi_stats_t *i2c_multi_get_stats(i2c_multi_t *i2c_multi) { return &i2c_multi->stats; }
+
+void i2c_multi_clear_stats(i2c_multi_t *i2c_multi) {
+    memset(&i2c_multi->stats, 0, sizeof(i2c_multi->stats));
+    i2c_multi->stats.isr_cycles_min = UINT32_MAX;
+    i2c_multi->stats.hold_after_entry_cycles_min = UINT32_MAX;
+}
+#endif
+
+static inline void bus_condition_program_init(i2c_multi_t *i2c_multi, PIO pio, uint sm, uint offset, uint pin) {
+    pio_sm_config c = bus_condition_program_get_default_config(offset);
     sm_config_set_in_pins(&c, pin);
     sm_config_set_clkdiv(&c, CLK_DIV);
     sm_config_set_jmp_pin(&c, pin + 1);
-    pio_sm_init(pio, sm, offset + stop_condition_offset_start, &c);
+    pio_sm_init(pio, sm, offset + bus_condition_offset_start, &c);
     pio_sm_set_enabled(pio, sm, true);
     pio_set_irq1_source_enabled(pio, pis_interrupt1, true);
     pio_interrupt_clear(pio, 1);
+
+    // START: bus_condition pushes an empty word, which is executed by transfer_byte as jmp 0 (the program is loaded
+    // at offset 0). The byte state machine is back at the address on every START without waiting for the CPU
+    i2c_multi->dma_start_condition = dma_claim_unused_channel(true);
+    dma_channel_config c_dma = dma_channel_get_default_config(i2c_multi->dma_start_condition);
+    channel_config_set_transfer_data_size(&c_dma, DMA_SIZE_32);
+    channel_config_set_read_increment(&c_dma, false);
+    channel_config_set_write_increment(&c_dma, false);
+    channel_config_set_dreq(&c_dma, pio_get_dreq(pio, sm, false));
+    dma_channel_configure(i2c_multi->dma_start_condition, &c_dma, &pio->sm[i2c_multi->sm].instr, &pio->rxf[sm],
+                          START_CONDITION_COUNT, true);
 }
 
-static inline void read_byte_program_init(PIO pio, uint sm, uint offset, uint pin) {
-    pio_sm_config c = read_byte_program_get_default_config(offset);
+static inline void transfer_byte_program_init(PIO pio, uint sm, uint offset, uint pin) {
+    pio_sm_config c = transfer_byte_program_get_default_config(offset);
     sm_config_set_in_pins(&c, pin);
-    sm_config_set_clkdiv(&c, CLK_DIV);
-    sm_config_set_out_shift(&c, true, true, 32);
-    pio_set_irq0_source_enabled(pio, pis_interrupt0, true);
-    pio_interrupt_clear(pio, 0);
-    sm_config_set_set_pins(&c, pin, 2);
+    sm_config_set_out_pins(&c, pin, 1);
+    sm_config_set_set_pins(&c, pin + 1, 1);
     sm_config_set_sideset_pins(&c, pin);
-    pio_sm_init(pio, sm, offset, &c);
+    sm_config_set_jmp_pin(&c, pin);
+    sm_config_set_clkdiv(&c, CLK_DIV);
+    sm_config_set_in_shift(&c, false, false, 32);
+    sm_config_set_out_shift(&c, false, false, 8);
+    // Both lines are pulled low when enabled. SDA has its output enable inverted, so that out pindirs sends the data
+    // bits open drain, and is released before the pin is given to the PIO
+    pio_sm_set_pins_with_mask(pio, sm, 0, 3u << pin);
+    pio_sm_set_pindirs_with_mask(pio, sm, 1u << pin, 3u << pin);
+    gpio_set_oeover(pin, GPIO_OVERRIDE_INVERT);
+    pio_gpio_init(pio, pin);
+    pio_gpio_init(pio, pin + 1);
+    pio_sm_init(pio, sm, offset + transfer_byte_offset_idle, &c);
     pio_sm_set_enabled(pio, sm, true);
+    pio_set_irq0_source_enabled(pio, (pio_interrupt_source_t)(pis_sm0_rx_fifo_not_empty + sm), true);
+    pio_interrupt_clear(pio, 0);
 }
 
-static inline void write_byte_program_init(PIO pio, uint sm, uint offset, uint pin) {
-    pio_sm_config c = write_byte_program_get_default_config(offset);
+static inline void sniff_byte_program_init(i2c_multi_t *i2c_multi, PIO pio, uint sm, uint offset, uint pin) {
+    pio_sm_config c = sniff_byte_program_get_default_config(offset);
     sm_config_set_in_pins(&c, pin);
-    sm_config_set_out_pins(&c, pin, 1);
-    sm_config_set_set_pins(&c, pin, 2);
-    sm_config_set_sideset_pins(&c, pin);
     sm_config_set_clkdiv(&c, CLK_DIV);
-    sm_config_set_out_shift(&c, true, true, 32);
-    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
-    sm_config_set_jmp_pin(&c, pin);
-    pio_sm_init(pio, sm, offset, &c);
+    sm_config_set_in_shift(&c, false, false, 32);
+    // The lines are only sampled and are left to their GPIO function
+    pio_sm_init(pio, sm, offset + sniff_byte_offset_start, &c);
+    // Y marks the data bytes. The state machine waits on a pull from the empty TX FIFO until the first START replaces
+    // it with jmp 0, so a transfer already in progress is not decoded
+    pio_sm_exec(pio, sm, pio_encode_set(pio_y, 1));
+    pio_sm_exec(pio, sm, pio_encode_mov(pio_isr, pio_y));
+    pio_sm_exec(pio, sm, pio_encode_pull(false, true));
+
+    // RX FIFO -> ring, the lower half of each word. Never stopped, the ring is overwritten when it is not read in time
+    i2c_multi->dma_receive = dma_claim_unused_channel(true);
+    dma_channel_config c_dma = dma_channel_get_default_config(i2c_multi->dma_receive);
+    channel_config_set_transfer_data_size(&c_dma, DMA_SIZE_16);
+    channel_config_set_read_increment(&c_dma, false);
+    channel_config_set_write_increment(&c_dma, true);
+    channel_config_set_ring(&c_dma, true, i2c_multi->sniffer_ring_bits + 1);
+    channel_config_set_dreq(&c_dma, pio_get_dreq(pio, sm, false));
+    dma_channel_configure(i2c_multi->dma_receive, &c_dma, i2c_multi->sniffer_ring, &pio->rxf[sm], RECEIVE_RING_COUNT,
+                          true);
     pio_sm_set_enabled(pio, sm, true);
 }
 
-static inline void byte_handler_pio(void) {
-    uint8_t received = 0;
-    bool is_address = false;
-    i2c_multi->bytes_count++;
-    if (i2c_multi->status != I2C_WRITE) {
-        received = transpond_byte(pio_sm_get_blocking(i2c_multi->pio, i2c_multi->sm_read) >>
-                                  24);  // Do the bit-reverse here as PIO instructions are scarce
-    }
-    if (i2c_multi->status == I2C_IDLE) {
-        if (!i2c_multi_is_address_enabled(received >> 1)) {
-            i2c_multi->status = I2C_IDLE;
-            i2c_multi->bytes_count = 0;
-            pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-                       (((uint32_t)do_ack_program_instructions[10] + i2c_multi->offset_read) << 16) |
-                           do_ack_program_instructions[9]);
-            pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-                       (((uint32_t)do_ack_program_instructions[1]) << 16) | do_ack_program_instructions[0]);
-            pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-                       (((uint32_t)do_ack_program_instructions[3]) << 16) | do_ack_program_instructions[2]);
-            pio_interrupt_clear(i2c_multi->pio, 0);
-            return;
-        }
-        if (received & 1) {
-            i2c_multi->status = I2C_WRITE;
-        } else {
-            i2c_multi->status = I2C_READ;
-        }
-        is_address = true;
-    }
-    if (i2c_multi->status == I2C_READ) {
-        pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-                   (((uint32_t)do_ack_program_instructions[5]) << 16) | do_ack_program_instructions[4]);
-        pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-                   (((uint32_t)do_ack_program_instructions[7] + i2c_multi->offset_read) << 16) |
-                       do_ack_program_instructions[6]);
-        pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-                   (((uint32_t)do_ack_program_instructions[1]) << 16) | do_ack_program_instructions[0]);
-        pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-                   (((uint32_t)do_ack_program_instructions[3]) << 16) | do_ack_program_instructions[2]);
-        if (receive_handler) {
-            if (is_address) {
-                receive_handler(received >> 1, true);
-            } else
-                receive_handler(received, false);
-        }
+// The handlers and everything they call run from RAM, a cache miss on flash would stall them with SCL held
+static void __not_in_flash_func(byte_handler_pio0)(void) {
+    byte_handler_pio(&i2c_multi_instance[0], I2C_FEATURE_ALL, i2c_multi_dispatch);
+}
+
+static void __not_in_flash_func(byte_handler_pio1)(void) {
+    byte_handler_pio(&i2c_multi_instance[1], I2C_FEATURE_ALL, i2c_multi_dispatch);
+}
+
+static void __not_in_flash_func(stop_handler_pio0)(void) {
+    stop_handler_pio(&i2c_multi_instance[0], I2C_FEATURE_ALL, i2c_multi_dispatch);
+}
+
+static void __not_in_flash_func(stop_handler_pio1)(void) {
+    stop_handler_pio(&i2c_multi_instance[1], I2C_FEATURE_ALL, i2c_multi_dispatch);
+}
+
+static void __not_in_flash_func(core1_entry)(void) {
+    // Nothing else runs on core1 and it never leaves RAM, so core0 can write the flash without stopping it
+    for (uint i = 0; i < NUM_PIOS; i++)
+        if (core1_instances & (1u << i)) i2c_multi_enable_core1_irq(&i2c_multi_instance[i], true);
+    while (true) __wfi();
+}
+
+static void fifo_handler(void) {
+    // The words only wake core0 up, the queues of every instance on core1 are run
+    multicore_fifo_drain();
+    multicore_fifo_clear_irq();
+    for (uint i = 0; i < NUM_PIOS; i++)
+        if ((core1_instances & (1u << i)) && i2c_multi_instance[i].event_queue) i2c_multi_task(&i2c_multi_instance[i]);
+}
+
+static inline uint16_t bus_divider(uint32_t scl_hz) {
+    // Every delay of the programs is counted in PIO cycles, so the divider alone scales the timing
+    uint32_t div = scl_hz ? clock_get_hz(clk_sys) / (scl_hz * SCL_PERIOD_CYCLES) : CLK_DIV;
+    if (div < 1) div = 1;
+    if (div > 0xFFFF) div = 0xFFFF;
+    return div;
+}
+
+void __not_in_flash_func(i2c_multi_dispatch)(i2c_multi_t *i2c_multi, uint64_t event) {
+    uint8_t data = event >> 32;
+    uint32_t length = event;
+    uint8_t type = event >> 40;
+    // The events of a transfer go to the device of its address. 10-bit addresses only have the global handlers
+    if (type != EVENT_ADDRESS_10BIT && i2c_multi->device[event >> 48]) {
+        dispatch_device(i2c_multi, event);
+        return;
     }
-    if (i2c_multi->status == I2C_WRITE && is_address) {
-        if (request_handler) request_handler(received >> 1);
-        uint8_t value = 0;
-        if (i2c_multi->buffer) {
-            value = transpond_byte(*i2c_multi->buffer);
-            i2c_multi->buffer++;
-        }
-        pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-                   (((uint32_t)do_ack_program_instructions[5]) << 16) | do_ack_program_instructions[4]);
-        pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-                   (((uint32_t)do_ack_program_instructions[8] + i2c_multi->offset_read) << 16) |
-                       do_ack_program_instructions[6]);
-        pio_sm_put(i2c_multi->pio, i2c_multi->sm_read,
-                   (((uint32_t)do_ack_program_instructions[1]) << 16) | do_ack_program_instructions[0]);
-        pio_sm_put_blocking(i2c_multi->pio, i2c_multi->sm_read,
-                            (((uint32_t)do_ack_program_instructions[3]) << 16) | do_ack_program_instructions[2]);
-
-        pio_sm_put(i2c_multi->pio, i2c_multi->sm_write, value);
-        pio_sm_put(i2c_multi->pio, i2c_multi->sm_write,
-                   (((uint32_t)wait_ack_program_instructions[1]) << 16) | wait_ack_program_instructions[0]);
-        pio_sm_put(i2c_multi->pio, i2c_multi->sm_write,
-                   (((uint32_t)wait_ack_program_instructions[3]) << 16) | wait_ack_program_instructions[2]);
+    switch (type) {
+        case EVENT_ADDRESS:
+            if (i2c_multi->receive_handler) i2c_multi->receive_handler(data, true);
+            break;
+        case EVENT_DATA:
+            if (i2c_multi->receive_handler) i2c_multi->receive_handler(data, false);
+            break;
+        case EVENT_REQUEST:
+            if (i2c_multi->request_handler) i2c_multi->request_handler(data);
+            break;
+        case EVENT_REPEATED_START:
+            if (i2c_multi->repeated_start_handler) {
+                i2c_multi->repeated_start_handler(length);
+                break;
+            }
+            // fall through
+        case EVENT_STOP:
+            if (i2c_multi->stop_handler) i2c_multi->stop_handler(length);
+            break;
+        case EVENT_RECEIVE_BUFFER:
+            if (i2c_multi->receive_buffer_handler)
+                i2c_multi->receive_buffer_handler(data, i2c_multi->receive_buffer[data], length);
+            break;
+        case EVENT_ADDRESS_10BIT:
+            if (i2c_multi->address_10bit_handler) i2c_multi->address_10bit_handler(length, data);
+            break;
+        case EVENT_STREAM:
+            if (i2c_multi->stream_handler) {
+                uint8_t address = data & 0x7F;
+                uint8_t *chunk = i2c_multi->stream[address] + (length >> 16) * i2c_multi->stream_size[address];
+                i2c_multi->stream_handler(address, chunk, (uint16_t)length, data >> 7);
+            }
+            break;
+        case EVENT_PEC_ERROR:
+            if (i2c_multi->pec_error_handler) i2c_multi->pec_error_handler(data);
+            break;
     }
-    if (i2c_multi->status == I2C_WRITE && !is_address) {
-        if (i2c_multi->length == -1 || (i2c_multi->length > 0 && i2c_multi->bytes_count < i2c_multi->length + 1)) {
-            uint8_t value = 0;
-            if (i2c_multi->buffer) {
-                value = transpond_byte(*i2c_multi->buffer);
-                i2c_multi->buffer++;
+}
+
+static inline void __not_in_flash_func(dispatch_device)(i2c_multi_t *i2c_multi, uint64_t event) {
+    const i2c_multi_device_t *device = i2c_multi->device[event >> 48];
+    void *context = i2c_multi->context[event >> 48];
+    uint8_t type = event >> 40;
+    uint8_t data = event >> 32;
+    uint32_t length = event;
+    switch (type) {
+        case EVENT_ADDRESS:
+        case EVENT_DATA:
+            if (device->receive_handler) device->receive_handler(context, data, type == EVENT_ADDRESS);
+            break;
+        case EVENT_REQUEST:
+            if (device->request_handler) device->request_handler(context, data);
+            break;
+        case EVENT_REPEATED_START:
+            if (device->repeated_start_handler) {
+                device->repeated_start_handler(context, length);
+                break;
             }
-            pio_sm_put(i2c_multi->pio, i2c_multi->sm_write,
-                       (((uint32_t)wait_ack_program_instructions[5]) << 16) | wait_ack_program_instructions[4]);
-            pio_sm_put(i2c_multi->pio, i2c_multi->sm_write,
-                       (((uint32_t)wait_ack_program_instructions[7] + i2c_multi->offset_write) << 16) |
-                           (wait_ack_program_instructions[6]) + i2c_multi->offset_write);
-            pio_sm_put(i2c_multi->pio, i2c_multi->sm_write, value);
-            pio_sm_put(i2c_multi->pio, i2c_multi->sm_write,
-                       (((uint32_t)wait_ack_program_instructions[1]) << 16) | wait_ack_program_instructions[0]);
-            pio_sm_put(i2c_multi->pio, i2c_multi->sm_write,
-                       (((uint32_t)wait_ack_program_instructions[3]) << 16) | wait_ack_program_instructions[2]);
-        } else {
-            pio_sm_exec(i2c_multi->pio, i2c_multi->sm_read, i2c_multi->offset_read);
-            pio_sm_clear_fifos(i2c_multi->pio, i2c_multi->sm_write);
-            pio_sm_exec(i2c_multi->pio, i2c_multi->sm_write, wait_ack_program_instructions[8]);
-            pio_sm_exec(i2c_multi->pio, i2c_multi->sm_write,
-                        wait_ack_program_instructions[9] + i2c_multi->offset_write);
-            if (stop_handler) {
-                stop_handler(i2c_multi->bytes_count - 1);
+            // fall through
+        case EVENT_STOP:
+            if (device->stop_handler) device->stop_handler(context, length);
+            break;
+        case EVENT_RECEIVE_BUFFER:
+            if (device->receive_buffer_handler)
+                device->receive_buffer_handler(context, data, i2c_multi->receive_buffer[data], length);
+            break;
+        case EVENT_STREAM:
+            if (device->stream_handler) {
+                uint8_t address = data & 0x7F;
+                uint8_t *chunk = i2c_multi->stream[address] + (length >> 16) * i2c_multi->stream_size[address];
+                device->stream_handler(context, address, chunk, (uint16_t)length, data >> 7);
             }
-            i2c_multi->bytes_count = 0;
-            i2c_multi->buffer = i2c_multi->buffer_start;
-            i2c_multi->status = I2C_IDLE;
-        }
+            break;
+        case EVENT_PEC_ERROR:
+            if (device->pec_error_handler) device->pec_error_handler(context, data);
+            break;
     }
-    pio_interrupt_clear(i2c_multi->pio, 0);
 }
 
-static inline void stop_handler_pio(void) {
-    pio_interrupt_clear(i2c_multi->pio, 1);
-    if (i2c_multi->status == I2C_IDLE) return;
-    pio_sm_exec(i2c_multi->pio, i2c_multi->sm_read, i2c_multi->offset_read);
-    pio_sm_clear_fifos(i2c_multi->pio, i2c_multi->sm_write);
-    pio_sm_exec(i2c_multi->pio, i2c_multi->sm_write, wait_ack_program_instructions[8]);
-    pio_sm_exec(i2c_multi->pio, i2c_multi->sm_write, wait_ack_program_instructions[9] + i2c_multi->offset_write);
-    i2c_multi->buffer = i2c_multi->buffer_start;
-    if (stop_handler) stop_handler(i2c_multi->bytes_count - 1);
-    i2c_multi->bytes_count = 0;
-    i2c_multi->status = I2C_IDLE;
+static void crc8_table_init(void) {
+    if (i2c_multi_crc8_table[1]) return;
+    for (uint i = 0; i < 256; i++) {
+        uint8_t crc = i;
+        for (uint bit = 0; bit < 8; bit++) crc = crc & 0x80 ? crc << 1 ^ PEC_POLYNOMIAL : crc << 1;
+        i2c_multi_crc8_table[i] = crc;
+    }
 }
 
-static inline uint8_t transpond_byte(uint8_t byte) {
-    uint8_t transponded = ((byte & 0x1) << 7) | (((byte & 0x2) >> 1) << 6) | (((byte & 0x4) >> 2) << 5) |
-                          (((byte & 0x8) >> 3) << 4) | (((byte & 0x10) >> 4) << 3) | (((byte & 0x20) >> 5) << 2) |
-                          (((byte & 0x40) >> 6) << 1) | (((byte & 0x80) >> 7));
-    return transponded;
+#ifdef I2C_MULTI_STATS
+static inline void __not_in_flash_func(stats_systick_start)(void) {
+    // Free running on the processor clock, unless already started elsewhere
+    if (!(systick_hw->csr & 1)) {
+        systick_hw->rvr = 0xFFFFFF;
+        systick_hw->cvr = 0;
+        systick_hw->csr = 0x5;
+    }
 }
+#endif
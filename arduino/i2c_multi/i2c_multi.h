@@ -8,38 +8,203 @@ extern "C" {
 #include <stdlib.h>
 
 #include "hardware/pio.h"
+#include "hardware/sync.h"
 #include "i2c_multi.pio.h"
 
+// Sniffer ring entries. Address and data bytes are stored as byte << 1 | nack, the other entries are the end of a
+// transfer, written at the next START
+#define I2C_SNIFF_ADDRESS 0x400
+#define I2C_SNIFF_DATA 0x200
+#define I2C_SNIFF_NACK 0x001
+#define I2C_SNIFF_FIRST_START 0x001
+#define I2C_SNIFF_STOP 0x002
+#define I2C_SNIFF_REPEATED_START 0x003
+
 typedef enum i2c_multi_status_t { I2C_IDLE, I2C_READ, I2C_WRITE } i2c_multi_status_t;
 
+typedef enum i2c_multi_trace_type_t {
+    I2C_TRACE_ADDRESS_ACK,
+    I2C_TRACE_ADDRESS_NACK,
+    I2C_TRACE_DATA,
+    I2C_TRACE_DATA_NACK,
+    I2C_TRACE_REPEATED_START,
+    I2C_TRACE_STOP,
+    I2C_TRACE_ADDRESS_10BIT_ACK,
+    I2C_TRACE_ADDRESS_10BIT_NACK,
+    I2C_TRACE_DATA_SENT,
+    I2C_TRACE_READ_NACK
+} i2c_multi_trace_type_t;
+
+// 8 bytes, dumped as stored (little endian)
+typedef struct i2c_multi_trace_t {
+    uint32_t time;  // microseconds
+    uint8_t type;
+    uint8_t data;  // address byte with the R/W bit, or data byte
+    uint16_t length;  // data bytes of the transfer ended by a STOP or repeated START, saturated, or the 10-bit address
+} i2c_multi_trace_t;
+
 typedef void (*i2c_multi_receive_handler_t)(uint8_t data, bool is_address);
 typedef void (*i2c_multi_request_handler_t)(uint8_t address);
-typedef void (*i2c_multi_stop_handler_t)(uint8_t length);
+typedef void (*i2c_multi_stop_handler_t)(uint32_t length);
+typedef void (*i2c_multi_repeated_start_handler_t)(uint32_t length);
+typedef void (*i2c_multi_receive_buffer_handler_t)(uint8_t address, uint8_t *buffer, uint16_t length);
+typedef void (*i2c_multi_address_10bit_handler_t)(uint16_t address, bool is_read);
+typedef void (*i2c_multi_stream_handler_t)(uint8_t address, uint8_t *chunk, uint16_t length, bool is_read);
+typedef void (*i2c_multi_pec_error_handler_t)(uint8_t address);
+
+// Handlers of one address, called with the context set with it. Any of them may be NULL
+typedef struct i2c_multi_device_t {
+    void (*receive_handler)(void *context, uint8_t data, bool is_address);
+    void (*request_handler)(void *context, uint8_t address);
+    void (*stop_handler)(void *context, uint32_t length);
+    void (*repeated_start_handler)(void *context, uint32_t length);
+    void (*receive_buffer_handler)(void *context, uint8_t address, uint8_t *buffer, uint16_t length);
+    void (*stream_handler)(void *context, uint8_t address, uint8_t *chunk, uint16_t length, bool is_read);
+    void (*pec_error_handler)(void *context, uint8_t address);
+} i2c_multi_device_t;
+
+#ifdef I2C_MULTI_STATS
+// Cycles are counted by SysTick on the processor clock
+typedef struct i2c_multi_stats_t {
+    uint32_t transactions[128];
+    uint32_t bytes_received, bytes_sent;
+    uint32_t nacked_addresses;
+    uint32_t rx_fifo_full;
+    uint32_t pec_errors;
+    uint32_t repeated_starts;
+    uint32_t isr_count, isr_cycles_min, isr_cycles_max;
+    uint64_t isr_cycles;
+    // SCL held for a CPU decision from the handler entry on. The interrupt latency before the entry is not included
+    uint32_t hold_after_entry_count, hold_after_entry_cycles_min, hold_after_entry_cycles_max;
+    uint64_t hold_after_entry_cycles;
+} i2c_multi_stats_t;
+#endif
 
 typedef struct i2c_multi_t {
     PIO pio;
-    uint offset_read, offset_write, sm_read, sm_write, offset_start, offset_stop, sm_start, sm_stop, pin;
+    uint offset, sm, offset_bus, sm_bus, pin;
+    uint dma_start_condition;
+    uint16_t jmp_ack, jmp_idle;  // forced jumps into transfer_byte
+    uint16_t clkdiv, hs_clkdiv;
+    bool hs_active;
     i2c_multi_status_t status;
-    uint8_t *buffer, *buffer_start;
-    uint8_t bytes_count;
-    int16_t length;
+    bool receive_only;
+    bool core1;
+    spin_lock_t *lock;  // address bitmaps
+    uint8_t *buffer, *buffer_start, *buffer_end, *buffer_back;
+    uint8_t *volatile buffer_latched;
+    uint32_t bytes_count, bytes_queued, bytes_padded;
+    uint32_t bytes_traced;  // bytes queued and recorded in the trace once pulled
+    uint8_t queued[4];      // last bytes queued, by count modulo the TX FIFO depth
+    int32_t length, transfer_length;
     uint address[4];
+    uint32_t address_10bit[32];
+    uint16_t matched_10bit;
+    uint8_t prefix_10bit;
+    uint8_t *response[128];
+    uint8_t *address_buffer[128];
+    int32_t address_length[128];
+    const i2c_multi_device_t *device[128];
+    void *context[128];
+    uint8_t *register_map[128];
+    uint16_t register_size[128], register_pointer[128], register_read_length[128];
+    uint8_t *registers;
+    uint16_t register_held;  // last byte of a write with a PEC, stored when the next one arrives
+    uint8_t *receive_buffer[128];
+    uint16_t receive_size[128];
+    uint8_t *received;
+    uint16_t received_length;
+    uint8_t *stream[128];
+    uint16_t stream_size[128];
+    uint32_t stream_position[128];
+    bool pec[128];
+    bool pec_active, pec_continue;  // transfer covered by a PEC, CRC carried over a repeated START
+    uint8_t crc;
+    uint8_t *streamed, *streamed_end, *chunk_end;
+    uint32_t chunk_count;
+    uint8_t current_address;
+    uint8_t *receive_ring;
+    uint8_t receive_ring_bits;
+    bool receive_ring_busy;
+    uint dma_receive;
+    uint16_t *sniffer_ring;
+    uint8_t sniffer_ring_bits;
+    bool write_dma, write_dma_busy;
+    uint dma_write, dma_pad;
+    uint64_t *event_queue;
+    uint16_t event_mask;
+    volatile uint16_t event_head, event_tail;
+    uint32_t events_dropped;
+    i2c_multi_trace_t *trace;
+    uint32_t trace_head;
+    uint16_t trace_mask;
+    i2c_multi_receive_handler_t receive_handler;
+    i2c_multi_request_handler_t request_handler;
+    i2c_multi_stop_handler_t stop_handler;
+    i2c_multi_repeated_start_handler_t repeated_start_handler;
+    i2c_multi_receive_buffer_handler_t receive_buffer_handler;
+    i2c_multi_address_10bit_handler_t address_10bit_handler;
+    i2c_multi_stream_handler_t stream_handler;
+    i2c_multi_pec_error_handler_t pec_error_handler;
+#ifdef I2C_MULTI_STATS
+    i2c_multi_stats_t stats;
+    uint32_t isr_start;
+#endif
 } i2c_multi_t;
 
-void i2c_multi_init(PIO pio, uint pin);
-void i2c_multi_set_write_buffer(uint8_t *buffer);
-void i2c_multi_set_receive_handler(i2c_multi_receive_handler_t handler);
-void i2c_multi_set_request_handler(i2c_multi_request_handler_t handler);
-void i2c_multi_set_stop_handler(i2c_multi_stop_handler_t handler);
-void i2c_multi_enable_address(uint8_t address);
-void i2c_multi_disable_address(uint8_t address);
-void i2c_multi_enable_all_addresses();
-void i2c_multi_disable_all_addresses();
-bool i2c_multi_is_address_enabled(uint8_t address);
-void i2c_multi_disable(void);
-void i2c_multi_restart(void);
-void i2c_multi_remove(void);
-void i2c_multi_fixed_length(int16_t length);
+i2c_multi_t *i2c_multi_init(PIO pio, uint pin);
+i2c_multi_t *i2c_multi_init_receive_only(PIO pio, uint pin);
+i2c_multi_t *i2c_multi_init_sniffer(PIO pio, uint pin, uint16_t *ring, uint8_t size_bits);
+void i2c_multi_set_write_buffer(i2c_multi_t *i2c_multi, uint8_t *buffer);
+void i2c_multi_set_back_buffer(i2c_multi_t *i2c_multi, uint8_t *buffer);
+uint8_t *i2c_multi_get_back_buffer(i2c_multi_t *i2c_multi);
+void i2c_multi_swap_buffers(i2c_multi_t *i2c_multi);
+void i2c_multi_set_address_buffer(i2c_multi_t *i2c_multi, uint8_t address, uint8_t *buffer, int32_t length);
+void i2c_multi_set_register_map(i2c_multi_t *i2c_multi, uint8_t address, uint8_t *registers, uint16_t size);
+void i2c_multi_set_register_read_length(i2c_multi_t *i2c_multi, uint8_t address, uint16_t length);
+void i2c_multi_set_receive_buffer(i2c_multi_t *i2c_multi, uint8_t address, uint8_t *buffer, uint16_t size);
+void i2c_multi_set_stream(i2c_multi_t *i2c_multi, uint8_t address, uint8_t *chunks, uint16_t chunk_size);
+bool i2c_multi_set_pec(i2c_multi_t *i2c_multi, uint8_t address, bool enabled);
+void i2c_multi_set_device(i2c_multi_t *i2c_multi, uint8_t address, const i2c_multi_device_t *device, void *context);
+void i2c_multi_set_receive_handler(i2c_multi_t *i2c_multi, i2c_multi_receive_handler_t handler);
+void i2c_multi_set_request_handler(i2c_multi_t *i2c_multi, i2c_multi_request_handler_t handler);
+void i2c_multi_set_stop_handler(i2c_multi_t *i2c_multi, i2c_multi_stop_handler_t handler);
+void i2c_multi_set_repeated_start_handler(i2c_multi_t *i2c_multi, i2c_multi_repeated_start_handler_t handler);
+void i2c_multi_set_receive_buffer_handler(i2c_multi_t *i2c_multi, i2c_multi_receive_buffer_handler_t handler);
+void i2c_multi_set_address_10bit_handler(i2c_multi_t *i2c_multi, i2c_multi_address_10bit_handler_t handler);
+void i2c_multi_set_stream_handler(i2c_multi_t *i2c_multi, i2c_multi_stream_handler_t handler);
+void i2c_multi_set_pec_error_handler(i2c_multi_t *i2c_multi, i2c_multi_pec_error_handler_t handler);
+void i2c_multi_enable_address(i2c_multi_t *i2c_multi, uint8_t address);
+void i2c_multi_disable_address(i2c_multi_t *i2c_multi, uint8_t address);
+void i2c_multi_enable_all_addresses(i2c_multi_t *i2c_multi);
+void i2c_multi_disable_all_addresses(i2c_multi_t *i2c_multi);
+bool i2c_multi_is_address_enabled(i2c_multi_t *i2c_multi, uint8_t address);
+void i2c_multi_enable_address_10bit(i2c_multi_t *i2c_multi, uint16_t address);
+void i2c_multi_disable_address_10bit(i2c_multi_t *i2c_multi, uint16_t address);
+bool i2c_multi_is_address_10bit_enabled(i2c_multi_t *i2c_multi, uint16_t address);
+void i2c_multi_disable(i2c_multi_t *i2c_multi);
+void i2c_multi_restart(i2c_multi_t *i2c_multi);
+void i2c_multi_remove(i2c_multi_t *i2c_multi);
+void i2c_multi_fixed_length(i2c_multi_t *i2c_multi, int32_t length);
+uint16_t i2c_multi_set_bus_speed(i2c_multi_t *i2c_multi, uint32_t scl_hz);
+uint16_t i2c_multi_set_hs_speed(i2c_multi_t *i2c_multi, uint32_t scl_hz);
+void i2c_multi_set_receive_ring(i2c_multi_t *i2c_multi, uint8_t *ring, uint8_t size_bits);
+uint16_t i2c_multi_get_receive_ring_head(i2c_multi_t *i2c_multi);
+uint16_t i2c_multi_get_sniffer_head(i2c_multi_t *i2c_multi);
+void i2c_multi_set_write_dma(i2c_multi_t *i2c_multi, bool enabled);
+void i2c_multi_set_core1(i2c_multi_t *i2c_multi, bool enabled);
+void i2c_multi_prepare_core1(i2c_multi_t *i2c_multi, bool enabled);
+void i2c_multi_enable_core1_irq(i2c_multi_t *i2c_multi, bool enabled);
+void i2c_multi_arm_response(i2c_multi_t *i2c_multi, uint8_t address, uint8_t *buffer);
+void i2c_multi_set_event_queue(i2c_multi_t *i2c_multi, uint64_t *queue, uint8_t size_bits);
+void i2c_multi_task(i2c_multi_t *i2c_multi);
+uint32_t i2c_multi_get_dropped_events(i2c_multi_t *i2c_multi);
+void i2c_multi_set_trace(i2c_multi_t *i2c_multi, i2c_multi_trace_t *buffer, uint8_t size_bits);
+void i2c_multi_dump_trace(i2c_multi_t *i2c_multi);
+#ifdef I2C_MULTI_STATS
+const i2c_multi_stats_t *i2c_multi_get_stats(i2c_multi_t *i2c_multi);
+void i2c_multi_clear_stats(i2c_multi_t *i2c_multi);
+#endif
 
 #ifdef __cplusplus
 }
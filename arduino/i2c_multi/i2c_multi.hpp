@@ -0,0 +1,303 @@
+#ifndef I2C_MULTI_HPP
+#define I2C_MULTI_HPP
+
+// C++17 front end. The devices of a bus, their addresses and the options are template parameters: the addresses and
+// options are validated at compile time and only the setters of the options in use are called. Each bus builds its
+// own interrupt handlers from i2c_multi_handler.h, with the paths of the options it does not use left out, and the
+// events of its devices call their objects directly, inlined into the handler. The events of the other addresses go
+// to the handlers of the C API. With an event queue, i2c_multi_task() runs the queued events through a constant
+// function-pointer table of each device set with i2c_multi_set_device().
+//
+//     struct sensor {
+//         void on_receive(uint8_t data, bool is_address);
+//         void on_stop(uint32_t length);
+//     } sensor_0x70;
+//     struct fast : i2c_multi::options {
+//         static constexpr uint32_t bus_speed = 1000000;
+//     };
+//     using bus = i2c_multi::bus<fast, i2c_multi::device<0x70, sensor_0x70>, i2c_multi::device<0x71, eeprom_0x71>>;
+//     i2c_multi_t *i2c = bus::init(pio0, 0);
+//
+// A device defines any of on_receive(uint8_t data, bool is_address), on_request(uint8_t address),
+// on_stop(uint32_t length), on_repeated_start(uint32_t length),
+// on_receive_buffer(uint8_t address, uint8_t *buffer, uint16_t length),
+// on_stream(uint8_t address, uint8_t *chunk, uint16_t length, bool is_read) and on_pec_error(uint8_t address). The
+// instance is the one of the C API, for the buffers and the 10-bit address handler.
+
+#include <type_traits>
+
+#include "hardware/irq.h"
+#include "i2c_multi.h"
+#include "i2c_multi_handler.h"
+
+namespace i2c_multi {
+
+// Options of a bus. Derive and redefine the ones to change. The features set on the instance through the C API are
+// built into the handlers only when enabled here
+struct options {
+    static constexpr bool receive_only = false;
+    static constexpr uint32_t bus_speed = 0;  // Hz, 0 keeps the default divider
+    static constexpr uint32_t hs_speed = 0;   // Hz, 0 without Hs-mode
+    static constexpr int32_t fixed_length = -1;
+    static constexpr bool write_dma = false;
+    static constexpr bool core1 = false;
+    static constexpr bool address_10bit = false;
+    static constexpr bool register_maps = false;
+    static constexpr bool receive_buffers = false;
+    static constexpr bool streams = false;
+    static constexpr bool receive_ring = false;
+    static constexpr bool event_queue = false;
+    static constexpr bool trace = false;
+};
+
+namespace detail {
+
+template <typename T, typename = void>
+struct has_receive : std::false_type {};
+template <typename T>
+struct has_receive<T, std::void_t<decltype(std::declval<T &>().on_receive(uint8_t(), bool()))>> : std::true_type {};
+
+template <typename T, typename = void>
+struct has_request : std::false_type {};
+template <typename T>
+struct has_request<T, std::void_t<decltype(std::declval<T &>().on_request(uint8_t()))>> : std::true_type {};
+
+template <typename T, typename = void>
+struct has_stop : std::false_type {};
+template <typename T>
+struct has_stop<T, std::void_t<decltype(std::declval<T &>().on_stop(uint32_t()))>> : std::true_type {};
+
+template <typename T, typename = void>
+struct has_repeated_start : std::false_type {};
+template <typename T>
+struct has_repeated_start<T, std::void_t<decltype(std::declval<T &>().on_repeated_start(uint32_t()))>>
+    : std::true_type {};
+
+template <typename T, typename = void>
+struct has_receive_buffer : std::false_type {};
+template <typename T>
+struct has_receive_buffer<
+    T, std::void_t<decltype(std::declval<T &>().on_receive_buffer(uint8_t(), (uint8_t *)nullptr, uint16_t()))>>
+    : std::true_type {};
+
+template <typename T, typename = void>
+struct has_stream : std::false_type {};
+template <typename T>
+struct has_stream<
+    T, std::void_t<decltype(std::declval<T &>().on_stream(uint8_t(), (uint8_t *)nullptr, uint16_t(), bool()))>>
+    : std::true_type {};
+
+template <typename T, typename = void>
+struct has_pec_error : std::false_type {};
+template <typename T>
+struct has_pec_error<T, std::void_t<decltype(std::declval<T &>().on_pec_error(uint8_t()))>> : std::true_type {};
+
+// Function-pointer table of one object, for the queued events. The object is a template parameter, so each entry calls
+// it without reading the context. Missing handlers are left NULL, the library skips them
+template <auto &Object>
+struct handlers {
+    using type = std::remove_reference_t<decltype(Object)>;
+
+    static constexpr decltype(i2c_multi_device_t::receive_handler) receive() {
+        if constexpr (has_receive<type>::value)
+            return [](void *, uint8_t data, bool is_address) { Object.on_receive(data, is_address); };
+        else
+            return nullptr;
+    }
+
+    static constexpr decltype(i2c_multi_device_t::request_handler) request() {
+        if constexpr (has_request<type>::value)
+            return [](void *, uint8_t address) { Object.on_request(address); };
+        else
+            return nullptr;
+    }
+
+    static constexpr decltype(i2c_multi_device_t::stop_handler) stop() {
+        if constexpr (has_stop<type>::value)
+            return [](void *, uint32_t length) { Object.on_stop(length); };
+        else
+            return nullptr;
+    }
+
+    static constexpr decltype(i2c_multi_device_t::repeated_start_handler) repeated_start() {
+        if constexpr (has_repeated_start<type>::value)
+            return [](void *, uint32_t length) { Object.on_repeated_start(length); };
+        else
+            return nullptr;
+    }
+
+    static constexpr decltype(i2c_multi_device_t::receive_buffer_handler) receive_buffer() {
+        if constexpr (has_receive_buffer<type>::value)
+            return [](void *, uint8_t address, uint8_t *buffer, uint16_t length) {
+                Object.on_receive_buffer(address, buffer, length);
+            };
+        else
+            return nullptr;
+    }
+
+    static constexpr decltype(i2c_multi_device_t::stream_handler) stream() {
+        if constexpr (has_stream<type>::value)
+            return [](void *, uint8_t address, uint8_t *chunk, uint16_t length, bool is_read) {
+                Object.on_stream(address, chunk, length, is_read);
+            };
+        else
+            return nullptr;
+    }
+
+    static constexpr decltype(i2c_multi_device_t::pec_error_handler) pec_error() {
+        if constexpr (has_pec_error<type>::value)
+            return [](void *, uint8_t address) { Object.on_pec_error(address); };
+        else
+            return nullptr;
+    }
+
+    static constexpr i2c_multi_device_t table = {receive(),        request(), stop(),     repeated_start(),
+                                                 receive_buffer(), stream(),  pec_error()};
+    static constexpr bool any =
+        receive() || request() || stop() || repeated_start() || receive_buffer() || stream() || pec_error();
+};
+
+template <uint8_t... Addresses>
+constexpr bool unique() {
+    constexpr uint8_t list[] = {Addresses...};
+    for (uint i = 0; i < sizeof...(Addresses); i++)
+        for (uint j = i + 1; j < sizeof...(Addresses); j++)
+            if (list[i] == list[j]) return false;
+    return true;
+}
+
+}  // namespace detail
+
+// Object with static storage answering one 7-bit address, with SMBus PEC when Pec is set
+template <uint8_t Address, auto &Object, bool Pec = false>
+struct device {
+    static_assert(Address < 0x80, "7-bit address");
+    static_assert(Address < 0x78 || Address > 0x7B, "0x78 to 0x7B are the prefixes of the 10-bit addresses");
+    static_assert(detail::handlers<Object>::any, "a device defines at least one handler");
+
+    static constexpr uint8_t address = Address;
+    static constexpr bool pec = Pec;
+
+    template <bool Queued>
+    static void attach(i2c_multi_t *i2c_multi) {
+        if constexpr (Queued)
+            i2c_multi_set_device(i2c_multi, Address, &detail::handlers<Object>::table, (void *)&Object);
+        if constexpr (Pec) i2c_multi_set_pec(i2c_multi, Address, true);
+        i2c_multi_enable_address(i2c_multi, Address);
+    }
+
+    // Calls the object for an event of its address, false for the other addresses
+    static bool dispatch([[maybe_unused]] i2c_multi_t *i2c_multi, uint64_t event) {
+        using type = typename detail::handlers<Object>::type;
+        if ((uint8_t)(event >> 48) != Address) return false;
+        uint8_t type_event = event >> 40;
+        uint8_t data = event >> 32;
+        uint32_t length = event;
+        switch (type_event) {
+            case EVENT_ADDRESS:
+            case EVENT_DATA:
+                if constexpr (detail::has_receive<type>::value) Object.on_receive(data, type_event == EVENT_ADDRESS);
+                break;
+            case EVENT_REQUEST:
+                if constexpr (detail::has_request<type>::value) Object.on_request(data);
+                break;
+            case EVENT_REPEATED_START:
+                if constexpr (detail::has_repeated_start<type>::value) {
+                    Object.on_repeated_start(length);
+                    break;
+                }
+                [[fallthrough]];
+            case EVENT_STOP:
+                if constexpr (detail::has_stop<type>::value) Object.on_stop(length);
+                break;
+            case EVENT_RECEIVE_BUFFER:
+                if constexpr (detail::has_receive_buffer<type>::value)
+                    Object.on_receive_buffer(Address, i2c_multi->receive_buffer[Address], length);
+                break;
+            case EVENT_STREAM:
+                if constexpr (detail::has_stream<type>::value)
+                    Object.on_stream(Address,
+                                     i2c_multi->stream[Address] + (length >> 16) * i2c_multi->stream_size[Address],
+                                     (uint16_t)length, data >> 7);
+                break;
+            case EVENT_PEC_ERROR:
+                if constexpr (detail::has_pec_error<type>::value) Object.on_pec_error(Address);
+                break;
+        }
+        return true;
+    }
+};
+
+template <typename Options, typename... Devices>
+class bus {
+    static_assert(std::is_base_of_v<options, Options>, "options derive from i2c_multi::options");
+    static_assert(detail::unique<Devices::address...>(), "one device per address");
+    static_assert(Options::fixed_length >= -1, "fixed length is -1 or a byte count");
+    static_assert(!Options::hs_speed || Options::hs_speed > Options::bus_speed, "Hs speed above the bus speed");
+    static_assert(!(Options::receive_only && Options::write_dma), "nothing to send receive only");
+
+   public:
+    // Paths built into the handlers of this bus, the PEC when a device has it
+    static constexpr uint32_t features =
+        (Options::receive_only ? 0 : I2C_FEATURE_WRITE) | (Options::fixed_length != -1 ? I2C_FEATURE_FIXED_LENGTH : 0) |
+        (Options::hs_speed ? I2C_FEATURE_HS_MODE : 0) | (Options::address_10bit ? I2C_FEATURE_ADDRESS_10BIT : 0) |
+        ((Devices::pec || ...) ? I2C_FEATURE_PEC : 0) | (Options::register_maps ? I2C_FEATURE_REGISTER_MAPS : 0) |
+        (Options::receive_buffers ? I2C_FEATURE_RECEIVE_BUFFERS : 0) | (Options::streams ? I2C_FEATURE_STREAMS : 0) |
+        (Options::receive_ring ? I2C_FEATURE_RECEIVE_RING : 0) | (Options::write_dma ? I2C_FEATURE_WRITE_DMA : 0) |
+        (Options::event_queue ? I2C_FEATURE_EVENT_QUEUE : 0) | (Options::core1 ? I2C_FEATURE_CORE1 : 0) |
+        (Options::trace ? I2C_FEATURE_TRACE : 0);
+
+    // Loads the programs on the PIO and serves the devices, nullptr if the PIO already runs an instance. The
+    // interrupts are moved to core1 last, once every address is set
+    static i2c_multi_t *init(PIO pio, uint pin) {
+        i2c_multi_t *i2c_multi;
+        if constexpr (Options::receive_only)
+            i2c_multi = i2c_multi_init_receive_only(pio, pin);
+        else
+            i2c_multi = i2c_multi_init(pio, pin);
+        if (!i2c_multi) return nullptr;
+        if constexpr (Options::bus_speed != 0) i2c_multi_set_bus_speed(i2c_multi, Options::bus_speed);
+        if constexpr (Options::hs_speed != 0) i2c_multi_set_hs_speed(i2c_multi, Options::hs_speed);
+        if constexpr (Options::fixed_length != -1) i2c_multi_fixed_length(i2c_multi, Options::fixed_length);
+        if constexpr (Options::write_dma) i2c_multi_set_write_dma(i2c_multi, true);
+        set_handlers(pio);
+        (Devices::template attach<Options::event_queue>(i2c_multi), ...);
+        if constexpr (Options::core1) i2c_multi_set_core1(i2c_multi, true);
+        return i2c_multi;
+    }
+
+   private:
+    // The events of the devices call their objects, the others go to the handlers of the C API
+    static void __not_in_flash_func(dispatch)(i2c_multi_t *i2c_multi, uint64_t event) {
+        if (!(Devices::dispatch(i2c_multi, event) || ...)) i2c_multi_dispatch(i2c_multi, event);
+    }
+
+    template <uint Index>
+    static void __not_in_flash_func(byte_handler)() {
+        byte_handler_pio(&i2c_multi_instance[Index], features, dispatch);
+    }
+
+    template <uint Index>
+    static void __not_in_flash_func(stop_handler)() {
+        stop_handler_pio(&i2c_multi_instance[Index], features, dispatch);
+    }
+
+    static void set_handlers(PIO pio) {
+        // In place of the handlers of the library, with the interrupts off: a START is served even before the
+        // addresses are enabled
+        uint pio_irq0 = (pio == pio0 ? PIO0_IRQ_0 : PIO1_IRQ_0);
+        uint pio_irq1 = (pio == pio0 ? PIO0_IRQ_1 : PIO1_IRQ_1);
+        irq_set_enabled(pio_irq0, false);
+        irq_set_enabled(pio_irq1, false);
+        irq_remove_handler(pio_irq0, irq_get_exclusive_handler(pio_irq0));
+        irq_remove_handler(pio_irq1, irq_get_exclusive_handler(pio_irq1));
+        irq_set_exclusive_handler(pio_irq0, pio == pio0 ? byte_handler<0> : byte_handler<1>);
+        irq_set_exclusive_handler(pio_irq1, pio == pio0 ? stop_handler<0> : stop_handler<1>);
+        irq_set_enabled(pio_irq0, true);
+        irq_set_enabled(pio_irq1, true);
+    }
+};
+
+}  // namespace i2c_multi
+
+#endif
@@ -0,0 +1,803 @@
+#ifndef I2C_MULTI_HANDLER
+#define I2C_MULTI_HANDLER
+
+// Interrupt handlers of the library, included by i2c_multi.c and i2c_multi.hpp only. Every function is inlined into
+// the handler entry points, which run from RAM. The features are compile-time flags, so the paths left out are not
+// compiled, and the events are passed to the dispatch given as a direct call. The library builds its handlers with
+// every feature and the handlers of the API, the C++ front end with the features of its options and the calls to its
+// devices
+
+#include "i2c_multi.h"
+
+#include "hardware/dma.h"
+#include "hardware/timer.h"
+#include "pico/multicore.h"
+#ifdef I2C_MULTI_STATS
+#include "hardware/structs/systick.h"
+#define STATS(statement) statement
+#else
+#define STATS(statement)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FIFO_DEPTH 4  // neither FIFO is joined
+#define RECEIVE_RING_COUNT 0xFFFFFFFF
+#define WRITE_DMA_COUNT 0xFFFFFFFF
+#define WRITE_PAD 0xFFFFFFFF  // sent past the end of the data, all lanes
+#define ADDRESS_MARK 0x100
+#define REGISTER_HELD 0x100  // register_held is set
+#define HS_MASTER_CODE 0x08  // 0000 1XXX, the master id in the last 3 bits
+#define ADDRESS_10BIT_PREFIX 0xF0  // 1111 0XXR, the upper 2 bits of a 10-bit address and the R/W bit
+#define ADDRESS_10BIT_NONE 0xFFFF
+
+// Paths of the handlers. What a feature left out serves must not be set on the instance
+typedef enum i2c_multi_feature_t {
+    I2C_FEATURE_WRITE = 1 << 0,  // master reads, nacked without it
+    I2C_FEATURE_FIXED_LENGTH = 1 << 1,
+    I2C_FEATURE_HS_MODE = 1 << 2,
+    I2C_FEATURE_ADDRESS_10BIT = 1 << 3,
+    I2C_FEATURE_PEC = 1 << 4,
+    I2C_FEATURE_REGISTER_MAPS = 1 << 5,
+    I2C_FEATURE_RECEIVE_BUFFERS = 1 << 6,
+    I2C_FEATURE_STREAMS = 1 << 7,
+    I2C_FEATURE_RECEIVE_RING = 1 << 8,
+    I2C_FEATURE_WRITE_DMA = 1 << 9,
+    I2C_FEATURE_EVENT_QUEUE = 1 << 10,
+    I2C_FEATURE_CORE1 = 1 << 11,
+    I2C_FEATURE_TRACE = 1 << 12,
+    I2C_FEATURE_ALL = (1 << 13) - 1
+} i2c_multi_feature_t;
+
+typedef enum event_type_t {
+    EVENT_ADDRESS,  // all but EVENT_ADDRESS_10BIT dispatched to the device of the address
+    EVENT_DATA,
+    EVENT_REQUEST,
+    EVENT_STOP,
+    EVENT_REPEATED_START,
+    EVENT_RECEIVE_BUFFER,
+    EVENT_ADDRESS_10BIT,
+    EVENT_STREAM,
+    EVENT_PEC_ERROR
+} event_type_t;
+
+// Runs the handlers of an event: current_address << 48 | type << 40 | data << 32 | length
+typedef void (*i2c_multi_dispatch_t)(i2c_multi_t *i2c_multi, uint64_t event);
+
+// One instance per PIO, in static RAM so the handlers reach it without a pointer load
+extern i2c_multi_t i2c_multi_instance[NUM_PIOS];
+extern uint8_t i2c_multi_crc8_table[256];  // built at init, in RAM for the handlers
+
+// The handlers set through the API and the devices set with i2c_multi_set_device()
+void i2c_multi_dispatch(i2c_multi_t *i2c_multi, uint64_t event);
+
+static __force_inline void byte_handler_pio(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch);
+static __force_inline void stop_handler_pio(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch);
+static __force_inline void address_handler(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                           uint8_t received);
+static __force_inline bool address_enabled(i2c_multi_t *i2c_multi, uint8_t address);
+static __force_inline bool address_10bit_enabled(i2c_multi_t *i2c_multi, uint16_t address);
+static __force_inline void receive_byte(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                        uint8_t received);
+static __force_inline void register_store(i2c_multi_t *i2c_multi, uint8_t data);
+static __force_inline void receive_start(i2c_multi_t *i2c_multi, uint32_t features);
+static __force_inline void address_10bit_prefix(i2c_multi_t *i2c_multi, uint32_t features, uint8_t received);
+static __force_inline void address_10bit_match(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                               uint8_t received);
+static __force_inline void stream_start(i2c_multi_t *i2c_multi, uint8_t address);
+static __force_inline void stream_receive(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                          uint8_t received);
+static __force_inline void stream_fill(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch);
+static __force_inline void write_fifo_put(i2c_multi_t *i2c_multi, uint8_t data);
+static __force_inline void write_fifo_pad(i2c_multi_t *i2c_multi);
+static __force_inline void stream_chunk_done(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                             bool is_read, uint16_t length);
+static __force_inline void stream_end(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch);
+static __force_inline void transfer_end(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                        bool stop);
+static __force_inline void transfer_byte_jump(i2c_multi_t *i2c_multi, uint16_t jmp);
+static __force_inline void set_clkdiv(i2c_multi_t *i2c_multi, uint16_t div);
+static __force_inline void hs_mode_end(i2c_multi_t *i2c_multi);
+static __force_inline void transfer_byte_limit(i2c_multi_t *i2c_multi, uint32_t count);
+static __force_inline bool pec_held(i2c_multi_t *i2c_multi);
+static __force_inline void write_fifo_fill(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch);
+static __force_inline void receive_ring_stop(i2c_multi_t *i2c_multi);
+static __force_inline uint8_t receive_ring_take_last(i2c_multi_t *i2c_multi);
+static __force_inline void write_dma_start(i2c_multi_t *i2c_multi);
+static __force_inline void write_dma_stop(i2c_multi_t *i2c_multi);
+static __force_inline uint64_t event_encode(i2c_multi_t *i2c_multi, event_type_t type, uint8_t data, uint32_t length);
+static __force_inline void report(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                  event_type_t type, uint8_t data, uint32_t length);
+static __force_inline void trace_record(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_trace_type_t type,
+                                        uint8_t data, uint32_t length);
+static __force_inline void trace_sent(i2c_multi_t *i2c_multi, uint32_t features, uint32_t pulled);
+#ifdef I2C_MULTI_STATS
+static __force_inline uint32_t stats_elapsed(uint32_t start);
+static __force_inline void stats_isr_start(i2c_multi_t *i2c_multi);
+static __force_inline void stats_isr_end(i2c_multi_t *i2c_multi);
+static __force_inline void stats_hold_after_entry(i2c_multi_t *i2c_multi);
+static __force_inline void stats_sample(uint32_t cycles, uint32_t *count, uint32_t *min, uint32_t *max,
+                                        uint64_t *total);
+#endif
+
+static __force_inline void byte_handler_pio(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch) {
+    STATS(stats_isr_start(i2c_multi));
+    // With the receive ring running the next address is only noticed as the state machine waiting on irq 0, and it
+    // may have been moved to the ring already
+    if ((features & I2C_FEATURE_RECEIVE_RING) && i2c_multi->receive_ring_busy && pio_interrupt_get(i2c_multi->pio, 0)) {
+        receive_ring_stop(i2c_multi);
+        if (pio_sm_is_rx_fifo_empty(i2c_multi->pio, i2c_multi->sm)) {
+            uint8_t received = receive_ring_take_last(i2c_multi);
+            transfer_end(i2c_multi, features, dispatch, pio_interrupt_get(i2c_multi->pio, 1));
+            address_handler(i2c_multi, features, dispatch, received);
+        }
+    }
+    // The FIFO level is read once. Bytes pushed meanwhile keep the interrupt pending, so the handler is entered again
+    // instead of testing for empty after every byte
+    uint level = pio_sm_get_rx_fifo_level(i2c_multi->pio, i2c_multi->sm);
+    while (level--) {
+        uint32_t received = pio_sm_get(i2c_multi->pio, i2c_multi->sm);
+        if (!(received & ADDRESS_MARK)) {
+            if ((features & I2C_FEATURE_ADDRESS_10BIT) && i2c_multi->prefix_10bit)
+                address_10bit_match(i2c_multi, features, dispatch, received);
+            else if (i2c_multi->status == I2C_READ)
+                receive_byte(i2c_multi, features, dispatch, received);
+            continue;
+        }
+        // A new address ends the transfer in progress: by a repeated start, or by a STOP whose interrupt has not
+        // been served yet. Both may empty the FIFO, what is left is served on the next entry
+        if (i2c_multi->status != I2C_IDLE)
+            transfer_end(i2c_multi, features, dispatch, pio_interrupt_get(i2c_multi->pio, 1));
+        address_handler(i2c_multi, features, dispatch, received);
+        break;
+    }
+    if ((features & I2C_FEATURE_WRITE) && i2c_multi->status == I2C_WRITE &&
+        !((features & I2C_FEATURE_WRITE_DMA) && i2c_multi->write_dma_busy))
+        write_fifo_fill(i2c_multi, features, dispatch);
+    STATS(stats_isr_end(i2c_multi));
+}
+
+static __force_inline void stop_handler_pio(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch) {
+    // Already served by the byte handler when the next address came first
+    if (!pio_interrupt_get(i2c_multi->pio, 1)) return;
+    STATS(stats_isr_start(i2c_multi));
+    pio_interrupt_clear(i2c_multi->pio, 1);
+    if (i2c_multi->status != I2C_IDLE)
+        transfer_end(i2c_multi, features, dispatch, true);
+    else if ((features & I2C_FEATURE_HS_MODE) && i2c_multi->hs_active)
+        hs_mode_end(i2c_multi);
+    STATS(stats_isr_end(i2c_multi));
+}
+
+static __force_inline void address_handler(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                           uint8_t received) {
+    // The address is pushed two instructions before irq wait 0: the forced jumps and Y must not land earlier. SCL
+    // is held from the push on, so nothing can happen on the bus in between
+    while (!pio_interrupt_get(i2c_multi->pio, 0))
+        ;
+    // Only the next address after a repeated START continues the PEC, whoever it is for
+    bool pec_continue = (features & I2C_FEATURE_PEC) && i2c_multi->pec_continue;
+    i2c_multi->pec_continue = false;
+    // A STOP not served yet ended the Hs-mode of the previous transfer, before this address may start it again
+    if ((features & I2C_FEATURE_HS_MODE) && i2c_multi->hs_active && pio_interrupt_get(i2c_multi->pio, 1)) {
+        pio_interrupt_clear(i2c_multi->pio, 1);
+        hs_mode_end(i2c_multi);
+    }
+    uint8_t address = received >> 1;
+    // A master code is never acknowledged. SCL is held until the jump, so the faster divider is in place before
+    // the repeated START of the Hs-mode transfer
+    bool master_code = (received & 0xF8) == HS_MASTER_CODE;
+    if ((features & I2C_FEATURE_HS_MODE) && master_code && i2c_multi->hs_clkdiv && !i2c_multi->hs_active) {
+        set_clkdiv(i2c_multi, i2c_multi->hs_clkdiv);
+        i2c_multi->hs_active = true;
+    }
+    // 1111 0XX0 is followed by the rest of a 10-bit address. 1111 0XX1 reads from the 10-bit address matched last,
+    // which any other address or a STOP forgets. Without 10-bit addresses their prefixes are left disabled
+    bool address_10bit = (features & I2C_FEATURE_ADDRESS_10BIT) && (received & 0xF8) == ADDRESS_10BIT_PREFIX;
+    i2c_multi->prefix_10bit = 0;
+    if (address_10bit && !(received & 1)) {
+        address_10bit_prefix(i2c_multi, features, received);
+        return;
+    }
+    if (!address_10bit) i2c_multi->matched_10bit = ADDRESS_10BIT_NONE;
+    if (master_code ||
+        (address_10bit ? (i2c_multi->matched_10bit >> 8) != (address & 3) : !address_enabled(i2c_multi, address)) ||
+        ((received & 1) && (!(features & I2C_FEATURE_WRITE) || i2c_multi->receive_only))) {
+        transfer_byte_jump(i2c_multi, i2c_multi->jmp_idle);
+        STATS(i2c_multi->stats.nacked_addresses++);
+        trace_record(i2c_multi, features, I2C_TRACE_ADDRESS_NACK, received, 0);
+        return;
+    }
+    STATS(i2c_multi->stats.transactions[address]++);
+    trace_record(i2c_multi, features, I2C_TRACE_ADDRESS_ACK, received, 0);
+    i2c_multi->bytes_count = 1;
+    i2c_multi->current_address = address;
+    i2c_multi->registers =
+        (features & I2C_FEATURE_REGISTER_MAPS) && !address_10bit ? i2c_multi->register_map[address] : NULL;
+    // The PEC covers the address bytes and the data of the whole transaction. Streams are left out
+    i2c_multi->pec_active = (features & I2C_FEATURE_PEC) && !address_10bit && i2c_multi->pec[address] &&
+                            !((features & I2C_FEATURE_STREAMS) && i2c_multi->stream[address]);
+    if ((features & I2C_FEATURE_PEC) && i2c_multi->pec_active)
+        i2c_multi->crc = i2c_multi_crc8_table[(pec_continue ? i2c_multi->crc : 0) ^ received];
+    if ((features & I2C_FEATURE_WRITE) && (received & 1)) {
+        i2c_multi->status = I2C_WRITE;
+        // The write buffer is taken here, a swap during the read is sent from the next one
+        if ((features & I2C_FEATURE_CORE1) && i2c_multi->core1) {
+            spin_lock_unsafe_blocking(i2c_multi->lock);
+            i2c_multi->buffer = i2c_multi->buffer_latched = i2c_multi->buffer_start;
+            spin_unlock_unsafe(i2c_multi->lock);
+        } else {
+            i2c_multi->buffer = i2c_multi->buffer_latched = i2c_multi->buffer_start;
+        }
+        // A response known in advance is sent right away and the request is reported once the address is
+        // acknowledged. 10-bit addresses are answered from the write buffer only
+        uint8_t *response = address_10bit ? NULL : i2c_multi->response[address];
+        bool queued = (features & I2C_FEATURE_EVENT_QUEUE) && i2c_multi->event_queue;
+        i2c_multi->transfer_length = (features & I2C_FEATURE_FIXED_LENGTH) ? i2c_multi->length : -1;
+        if (address_10bit) {
+            if (i2c_multi->address_10bit_handler && !queued)
+                i2c_multi->address_10bit_handler(i2c_multi->matched_10bit, true);
+        } else if (response) {
+            i2c_multi->response[address] = NULL;
+            i2c_multi->buffer = response;
+            i2c_multi->registers = NULL;
+        } else if ((features & I2C_FEATURE_REGISTER_MAPS) && i2c_multi->registers) {
+            // Registers are read from the pointer on and wrap at the end of the map, up to the read length if set
+            response = i2c_multi->registers + i2c_multi->register_pointer[address];
+            i2c_multi->buffer = response;
+            i2c_multi->buffer_end = i2c_multi->registers + i2c_multi->register_size[address];
+            i2c_multi->transfer_length =
+                i2c_multi->register_read_length[address] ? i2c_multi->register_read_length[address] : -1;
+        } else if (i2c_multi->address_buffer[address]) {
+            response = i2c_multi->address_buffer[address];
+            i2c_multi->buffer = response;
+            i2c_multi->transfer_length = i2c_multi->address_length[address];
+        } else if ((features & I2C_FEATURE_STREAMS) && i2c_multi->stream[address]) {
+            stream_start(i2c_multi, address);
+            response = i2c_multi->buffer;
+        } else if (!queued) {
+            dispatch(i2c_multi, event_encode(i2c_multi, EVENT_REQUEST, address, 0));
+        }
+        // Drop the bytes left over from a master read ended by a repeated start
+        pio_sm_clear_fifos(i2c_multi->pio, i2c_multi->sm);
+        if ((features & I2C_FEATURE_WRITE_DMA) && i2c_multi->write_dma && i2c_multi->buffer &&
+            !((features & I2C_FEATURE_REGISTER_MAPS) && i2c_multi->registers) &&
+            !((features & I2C_FEATURE_STREAMS) && i2c_multi->streamed) &&
+            !((features & I2C_FEATURE_PEC) && i2c_multi->pec_active)) {
+            write_dma_start(i2c_multi);
+        } else {
+            i2c_multi->bytes_queued = 0;
+            i2c_multi->bytes_padded = 0;
+            i2c_multi->bytes_traced = 0;
+            write_fifo_fill(i2c_multi, features, dispatch);
+            pio_set_irq0_source_enabled(i2c_multi->pio,
+                                        (pio_interrupt_source_t)(pis_sm0_tx_fifo_not_full + i2c_multi->sm), true);
+        }
+        // X cleared falls through to the write path after the ack
+        pio_sm_exec(i2c_multi->pio, i2c_multi->sm, pio_encode_set(pio_x, 0));
+        transfer_byte_jump(i2c_multi, i2c_multi->jmp_ack);
+        if (address_10bit && queued)
+            report(i2c_multi, features, dispatch, EVENT_ADDRESS_10BIT, true, i2c_multi->matched_10bit);
+        else if (!address_10bit && (response || queued))
+            report(i2c_multi, features, dispatch, EVENT_REQUEST, address, 0);
+        return;
+    }
+    i2c_multi->status = I2C_READ;
+    if ((features & I2C_FEATURE_RECEIVE_BUFFERS) && !((features & I2C_FEATURE_REGISTER_MAPS) && i2c_multi->registers) &&
+        i2c_multi->receive_buffer[address]) {
+        // Delivered once at the end of the transfer, the byte after a full buffer is held for the CPU to nack. With a
+        // PEC the last byte of the buffer is held too, and only acknowledged when the PEC is good
+        uint16_t size = i2c_multi->receive_size[address];
+        i2c_multi->received = i2c_multi->receive_buffer[address];
+        i2c_multi->received_length = 0;
+        transfer_byte_limit(i2c_multi, (features & I2C_FEATURE_PEC) && i2c_multi->pec_active && size ? size - 1 : size);
+        transfer_byte_jump(i2c_multi, i2c_multi->jmp_ack);
+        return;
+    }
+    if ((features & I2C_FEATURE_STREAMS) && !((features & I2C_FEATURE_REGISTER_MAPS) && i2c_multi->registers) &&
+        i2c_multi->stream[address]) {
+        // Stored by the CPU without a limit, each full chunk is handed back while the other one is filled
+        stream_start(i2c_multi, address);
+        transfer_byte_jump(i2c_multi, i2c_multi->jmp_ack);
+        return;
+    }
+    receive_start(i2c_multi, features);
+    report(i2c_multi, features, dispatch, EVENT_ADDRESS, address, 0);
+}
+
+static __force_inline bool address_enabled(i2c_multi_t *i2c_multi, uint8_t address) {
+    return i2c_multi->address[address / 32] & (1u << (address % 32));
+}
+
+static __force_inline bool address_10bit_enabled(i2c_multi_t *i2c_multi, uint16_t address) {
+    return i2c_multi->address_10bit[(address & 0x3FF) / 32] & (1u << (address % 32));
+}
+
+static __force_inline void receive_start(i2c_multi_t *i2c_multi, uint32_t features) {
+    if ((features & I2C_FEATURE_RECEIVE_RING) && i2c_multi->receive_ring &&
+        !((features & I2C_FEATURE_REGISTER_MAPS) && i2c_multi->registers) &&
+        !((features & I2C_FEATURE_PEC) && i2c_multi->pec_active)) {
+        pio_set_irq0_source_enabled(i2c_multi->pio, (pio_interrupt_source_t)(pis_sm0_rx_fifo_not_empty + i2c_multi->sm),
+                                    false);
+        dma_channel_start(i2c_multi->dma_receive);
+        i2c_multi->receive_ring_busy = true;
+    }
+    transfer_byte_jump(i2c_multi, i2c_multi->jmp_ack);
+    if ((features & I2C_FEATURE_RECEIVE_RING) && i2c_multi->receive_ring_busy)
+        pio_set_irq0_source_enabled(i2c_multi->pio, pis_interrupt0, true);
+}
+
+static __force_inline void address_10bit_prefix(i2c_multi_t *i2c_multi, uint32_t features, uint8_t received) {
+    // Acknowledged when an enabled address has these upper bits, like every other slave sharing them. Y cleared
+    // holds the next byte for the CPU to match the lower bits
+    const uint32_t *group = &i2c_multi->address_10bit[(received & 6) << 2];
+    i2c_multi->matched_10bit = ADDRESS_10BIT_NONE;
+    if (!(group[0] | group[1] | group[2] | group[3] | group[4] | group[5] | group[6] | group[7])) {
+        transfer_byte_jump(i2c_multi, i2c_multi->jmp_idle);
+        STATS(i2c_multi->stats.nacked_addresses++);
+        trace_record(i2c_multi, features, I2C_TRACE_ADDRESS_NACK, received, 0);
+        return;
+    }
+    trace_record(i2c_multi, features, I2C_TRACE_ADDRESS_ACK, received, 0);
+    i2c_multi->prefix_10bit = received;
+    transfer_byte_limit(i2c_multi, 0);
+    transfer_byte_jump(i2c_multi, i2c_multi->jmp_ack);
+}
+
+static __force_inline void address_10bit_match(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                               uint8_t received) {
+    uint16_t address = (i2c_multi->prefix_10bit & 6) << 7 | received;
+    i2c_multi->prefix_10bit = 0;
+    // Held on irq wait 0 like an address, after jmp y-- has set Y back to all ones for the data bytes
+    while (!pio_interrupt_get(i2c_multi->pio, 0))
+        ;
+    if (!address_10bit_enabled(i2c_multi, address)) {
+        transfer_byte_jump(i2c_multi, i2c_multi->jmp_idle);
+        STATS(i2c_multi->stats.nacked_addresses++);
+        trace_record(i2c_multi, features, I2C_TRACE_ADDRESS_10BIT_NACK, received, address);
+        return;
+    }
+    // Counted and held as current address on its prefix, the per address buffers and register maps are not used
+    uint8_t prefix = ADDRESS_10BIT_PREFIX >> 1 | address >> 8;
+    STATS(i2c_multi->stats.transactions[prefix]++);
+    trace_record(i2c_multi, features, I2C_TRACE_ADDRESS_10BIT_ACK, received, address);
+    i2c_multi->matched_10bit = address;
+    i2c_multi->bytes_count = 1;
+    i2c_multi->current_address = prefix;
+    i2c_multi->registers = NULL;
+    i2c_multi->pec_active = false;
+    i2c_multi->status = I2C_READ;
+    receive_start(i2c_multi, features);
+    report(i2c_multi, features, dispatch, EVENT_ADDRESS_10BIT, false, address);
+}
+
+static __force_inline void stream_start(i2c_multi_t *i2c_multi, uint8_t address) {
+    // Continues where the last transfer on this address stopped. chunk_count is the byte count of the transfer at
+    // which the chunk in progress is done
+    uint16_t size = i2c_multi->stream_size[address];
+    uint32_t position = i2c_multi->stream_position[address];
+    i2c_multi->streamed = i2c_multi->stream[address];
+    i2c_multi->streamed_end = i2c_multi->streamed + 2 * size;
+    i2c_multi->buffer = i2c_multi->streamed + position;
+    i2c_multi->chunk_end = i2c_multi->streamed + (position < size ? size : 2 * size);
+    i2c_multi->chunk_count = i2c_multi->chunk_end - i2c_multi->buffer;
+}
+
+static __force_inline void stream_receive(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                          uint8_t received) {
+    *i2c_multi->buffer++ = received;
+    if (i2c_multi->bytes_count++ == i2c_multi->chunk_count)
+        stream_chunk_done(i2c_multi, features, dispatch, false, i2c_multi->stream_size[i2c_multi->current_address]);
+}
+
+static __force_inline void stream_fill(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch) {
+    // A chunk is handed back once its last byte has been pulled, the bytes queued after it are copies in the FIFO
+    uint level = pio_sm_get_tx_fifo_level(i2c_multi->pio, i2c_multi->sm);
+    uint32_t pulled = i2c_multi->bytes_queued + i2c_multi->bytes_padded - level;
+    if (pulled > i2c_multi->bytes_queued) pulled = i2c_multi->bytes_queued;
+    trace_sent(i2c_multi, features, pulled);
+    while (pulled >= i2c_multi->chunk_count)
+        stream_chunk_done(i2c_multi, features, dispatch, true, i2c_multi->stream_size[i2c_multi->current_address]);
+    for (uint free = FIFO_DEPTH - level; free; free--) {
+        if (i2c_multi->transfer_length != -1 && i2c_multi->bytes_queued >= (uint32_t)i2c_multi->transfer_length) {
+            write_fifo_pad(i2c_multi);
+            continue;
+        }
+        write_fifo_put(i2c_multi, *i2c_multi->buffer);
+        if (++i2c_multi->buffer == i2c_multi->streamed_end) i2c_multi->buffer = i2c_multi->streamed;
+    }
+}
+
+static __force_inline void stream_chunk_done(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                             bool is_read, uint16_t length) {
+    // Reported with the chunk index above the length, to be read or refilled while the other chunk is in use
+    uint16_t size = i2c_multi->stream_size[i2c_multi->current_address];
+    bool last = i2c_multi->chunk_end == i2c_multi->streamed_end;
+    report(i2c_multi, features, dispatch, EVENT_STREAM, i2c_multi->current_address | is_read << 7,
+           (uint32_t)last << 16 | length);
+    i2c_multi->chunk_count += size;
+    i2c_multi->chunk_end = last ? i2c_multi->streamed + size : i2c_multi->chunk_end + size;
+    // The fill wraps on its own, a few bytes ahead
+    if (!is_read) i2c_multi->buffer = i2c_multi->chunk_end - size;
+}
+
+static __force_inline void stream_end(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch) {
+    // The last chunk sent may not have been seen by the fill. A chunk partly received is handed back with its length
+    // and the next write starts on the other one, a master read resumes from the first byte not sent
+    uint16_t size = i2c_multi->stream_size[i2c_multi->current_address];
+    uint32_t count = i2c_multi->bytes_count - 1;
+    bool is_read = i2c_multi->status == I2C_WRITE;
+    while (is_read && count >= i2c_multi->chunk_count) stream_chunk_done(i2c_multi, features, dispatch, true, size);
+    uint32_t left = i2c_multi->chunk_count - count;
+    if (!is_read && left < size) {
+        stream_chunk_done(i2c_multi, features, dispatch, false, size - left);
+        left = size;
+    }
+    i2c_multi->stream_position[i2c_multi->current_address] = i2c_multi->chunk_end - left - i2c_multi->streamed;
+    i2c_multi->streamed = NULL;
+}
+
+static __force_inline void receive_byte(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                        uint8_t received) {
+    bool buffered = (features & I2C_FEATURE_RECEIVE_BUFFERS) && i2c_multi->received;
+    if (buffered && i2c_multi->received_length == i2c_multi->receive_size[i2c_multi->current_address]) {
+        transfer_byte_jump(i2c_multi, i2c_multi->jmp_idle);
+        trace_record(i2c_multi, features, I2C_TRACE_DATA_NACK, received, 0);
+        return;
+    }
+    if ((features & I2C_FEATURE_PEC) && i2c_multi->pec_active) {
+        i2c_multi->crc = i2c_multi_crc8_table[i2c_multi->crc ^ received];
+        if (buffered && !pec_held(i2c_multi)) {
+            trace_record(i2c_multi, features, I2C_TRACE_DATA_NACK, received, 0);
+            return;
+        }
+    }
+    trace_record(i2c_multi, features, I2C_TRACE_DATA, received, 0);
+    if ((features & I2C_FEATURE_STREAMS) && i2c_multi->streamed) {
+        stream_receive(i2c_multi, features, dispatch, received);
+        return;
+    }
+    if (buffered) {
+        i2c_multi->received[i2c_multi->received_length++] = received;
+        i2c_multi->bytes_count++;
+        return;
+    }
+    i2c_multi->bytes_count++;
+    if (!(features & I2C_FEATURE_REGISTER_MAPS) || !i2c_multi->registers) {
+        report(i2c_multi, features, dispatch, EVENT_DATA, received, 0);
+        return;
+    }
+    // The first data byte selects the register, the next ones are stored from there on
+    if (i2c_multi->bytes_count == 2) {
+        i2c_multi->register_pointer[i2c_multi->current_address] =
+            received % i2c_multi->register_size[i2c_multi->current_address];
+        return;
+    }
+    // With a PEC each byte is stored when the next one arrives, the one held at the STOP is the PEC
+    if ((features & I2C_FEATURE_PEC) && i2c_multi->pec_active) {
+        uint16_t held = i2c_multi->register_held;
+        i2c_multi->register_held = REGISTER_HELD | received;
+        if (!held) return;
+        received = held;
+    }
+    register_store(i2c_multi, received);
+}
+
+static __force_inline void register_store(i2c_multi_t *i2c_multi, uint8_t data) {
+    uint16_t *pointer = &i2c_multi->register_pointer[i2c_multi->current_address];
+    i2c_multi->registers[*pointer] = data;
+    if (++*pointer == i2c_multi->register_size[i2c_multi->current_address]) *pointer = 0;
+}
+
+static __force_inline void transfer_end(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                        bool stop) {
+    uint32_t next_address = 0;
+    if (stop) pio_interrupt_clear(i2c_multi->pio, 1);
+    if (i2c_multi->status == I2C_READ) {
+        if ((features & I2C_FEATURE_RECEIVE_RING) && i2c_multi->receive_ring_busy) receive_ring_stop(i2c_multi);
+        // Data bytes still queued. Reading the FIFO pops it, so an address found here is served once this transfer
+        // has ended
+        while (!pio_sm_is_rx_fifo_empty(i2c_multi->pio, i2c_multi->sm)) {
+            uint32_t received = pio_sm_get(i2c_multi->pio, i2c_multi->sm);
+            if (received & ADDRESS_MARK) {
+                next_address = received;
+                break;
+            }
+            receive_byte(i2c_multi, features, dispatch, received);
+        }
+    } else if ((features & I2C_FEATURE_WRITE_DMA) && i2c_multi->write_dma_busy) {
+        write_dma_stop(i2c_multi);
+    } else if (features & I2C_FEATURE_WRITE) {
+        pio_set_irq0_source_enabled(i2c_multi->pio, (pio_interrupt_source_t)(pis_sm0_tx_fifo_not_full + i2c_multi->sm),
+                                    false);
+        // A byte is pulled only after the master acks the previous one, so what is left in the FIFO was not sent.
+        // The padding is queued last and is not counted
+        uint32_t sent = i2c_multi->bytes_queued + i2c_multi->bytes_padded -
+                        pio_sm_get_tx_fifo_level(i2c_multi->pio, i2c_multi->sm);
+        i2c_multi->bytes_count += sent < i2c_multi->bytes_queued ? sent : i2c_multi->bytes_queued;
+        trace_sent(i2c_multi, features, sent);
+    }
+    if ((features & I2C_FEATURE_REGISTER_MAPS) && i2c_multi->buffer_end) {
+        // The PEC and the padding after the read length do not move the pointer
+        uint32_t sent = i2c_multi->bytes_count - 1;
+        if (i2c_multi->transfer_length != -1 && sent > (uint32_t)i2c_multi->transfer_length)
+            sent = i2c_multi->transfer_length;
+        uint16_t *pointer = &i2c_multi->register_pointer[i2c_multi->current_address];
+        *pointer = (*pointer + sent) % i2c_multi->register_size[i2c_multi->current_address];
+        i2c_multi->buffer_end = NULL;
+    }
+    if ((features & I2C_FEATURE_REGISTER_MAPS) && (features & I2C_FEATURE_PEC) && i2c_multi->register_held) {
+        // Data before a repeated START, the PEC comes at the end of the transaction
+        if (!stop) register_store(i2c_multi, i2c_multi->register_held);
+        i2c_multi->register_held = 0;
+    }
+    if ((features & I2C_FEATURE_STREAMS) && i2c_multi->streamed) stream_end(i2c_multi, features, dispatch);
+#ifdef I2C_MULTI_STATS
+    if (i2c_multi->status == I2C_READ)
+        i2c_multi->stats.bytes_received += i2c_multi->bytes_count - 1;
+    else
+        i2c_multi->stats.bytes_sent += i2c_multi->bytes_count - 1;
+    if (!stop) i2c_multi->stats.repeated_starts++;
+#endif
+    i2c_multi->registers = NULL;
+    i2c_multi->buffer = i2c_multi->buffer_start;
+    i2c_multi->buffer_latched = NULL;
+    if (features & I2C_FEATURE_PEC) {
+        // A write is checked at its STOP: the CRC over every byte, the PEC included, is 0. The slave sends the PEC
+        // of a transaction that continues after a repeated START
+        if (i2c_multi->pec_active && stop && i2c_multi->status == I2C_READ && i2c_multi->bytes_count > 1 &&
+            i2c_multi->crc) {
+            STATS(i2c_multi->stats.pec_errors++);
+            report(i2c_multi, features, dispatch, EVENT_PEC_ERROR, i2c_multi->current_address, 0);
+        }
+        i2c_multi->pec_continue = !stop && i2c_multi->pec_active;
+        i2c_multi->pec_active = false;
+    }
+    if ((features & I2C_FEATURE_RECEIVE_BUFFERS) && i2c_multi->received) {
+        report(i2c_multi, features, dispatch, EVENT_RECEIVE_BUFFER, i2c_multi->current_address,
+               i2c_multi->received_length);
+        i2c_multi->received = NULL;
+    }
+    // The master nacks the last byte it reads, the bytes queued after it never left the FIFO and were not recorded
+    if ((features & I2C_FEATURE_WRITE) && i2c_multi->status == I2C_WRITE)
+        trace_record(i2c_multi, features, I2C_TRACE_READ_NACK, 0, i2c_multi->bytes_count - 1);
+    trace_record(i2c_multi, features, stop ? I2C_TRACE_STOP : I2C_TRACE_REPEATED_START, 0, i2c_multi->bytes_count - 1);
+    report(i2c_multi, features, dispatch, stop ? EVENT_STOP : EVENT_REPEATED_START, 0, i2c_multi->bytes_count - 1);
+    i2c_multi->bytes_count = 0;
+    i2c_multi->status = I2C_IDLE;
+    if (stop) i2c_multi->matched_10bit = ADDRESS_10BIT_NONE;
+    if ((features & I2C_FEATURE_HS_MODE) && stop && i2c_multi->hs_active) hs_mode_end(i2c_multi);
+    if (next_address) address_handler(i2c_multi, features, dispatch, next_address);
+}
+
+static __force_inline void transfer_byte_jump(i2c_multi_t *i2c_multi, uint16_t jmp) {
+    // The state machine holds SCL on irq wait 0 after the address, the forced jump replaces it. The jumps are encoded
+    // at init for the offset the program was loaded at
+    pio_sm_exec(i2c_multi->pio, i2c_multi->sm, jmp);
+    pio_interrupt_clear(i2c_multi->pio, 0);
+    STATS(stats_hold_after_entry(i2c_multi));
+}
+
+static __force_inline void set_clkdiv(i2c_multi_t *i2c_multi, uint16_t div) {
+    pio_sm_set_clkdiv_int_frac(i2c_multi->pio, i2c_multi->sm, div, 0);
+    pio_sm_set_clkdiv_int_frac(i2c_multi->pio, i2c_multi->sm_bus, div, 0);
+    pio_clkdiv_restart_sm_mask(i2c_multi->pio, (1u << i2c_multi->sm) | (1u << i2c_multi->sm_bus));
+}
+
+static __force_inline void hs_mode_end(i2c_multi_t *i2c_multi) {
+    set_clkdiv(i2c_multi, i2c_multi->clkdiv);
+    i2c_multi->hs_active = false;
+}
+
+static __force_inline void transfer_byte_limit(i2c_multi_t *i2c_multi, uint32_t count) {
+    // Data bytes are acknowledged while Y counts down, the next one is held on irq wait 0 like an address
+    pio_sm_clear_fifos(i2c_multi->pio, i2c_multi->sm);
+    pio_sm_put(i2c_multi->pio, i2c_multi->sm, count);
+    pio_sm_exec(i2c_multi->pio, i2c_multi->sm, pio_encode_pull(false, false));
+    pio_sm_exec(i2c_multi->pio, i2c_multi->sm, pio_encode_mov(pio_y, pio_osr));
+}
+
+static __force_inline bool pec_held(i2c_multi_t *i2c_multi) {
+    // The last byte of the receive buffer was held on irq wait 0 after jmp y--. A bad PEC is nacked, a good one is
+    // acknowledged with the next byte held again, to be nacked as past the buffer
+    if (i2c_multi->received_length != i2c_multi->receive_size[i2c_multi->current_address] - 1) return true;
+    while (!pio_interrupt_get(i2c_multi->pio, 0))
+        ;
+    if (i2c_multi->crc) {
+        transfer_byte_jump(i2c_multi, i2c_multi->jmp_idle);
+        return false;
+    }
+    transfer_byte_limit(i2c_multi, 0);
+    transfer_byte_jump(i2c_multi, i2c_multi->jmp_ack);
+    return true;
+}
+
+static __force_inline void write_fifo_fill(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch) {
+    if ((features & I2C_FEATURE_STREAMS) && i2c_multi->streamed) {
+        stream_fill(i2c_multi, features, dispatch);
+        return;
+    }
+    // Filled up to the level read on entry. Slots freed meanwhile raise the interrupt again
+    uint level = pio_sm_get_tx_fifo_level(i2c_multi->pio, i2c_multi->sm);
+    trace_sent(i2c_multi, features, i2c_multi->bytes_queued + i2c_multi->bytes_padded - level);
+    for (uint free = FIFO_DEPTH - level; free; free--) {
+        if (!i2c_multi->buffer) {
+            write_fifo_pad(i2c_multi);
+            continue;
+        }
+        if (i2c_multi->transfer_length != -1 && i2c_multi->bytes_queued >= (uint32_t)i2c_multi->transfer_length) {
+            // The PEC follows the data once, a transfer without a length has none
+            if (!(features & I2C_FEATURE_PEC) || !i2c_multi->pec_active) {
+                write_fifo_pad(i2c_multi);
+                continue;
+            }
+            i2c_multi->pec_active = false;
+            write_fifo_put(i2c_multi, i2c_multi->crc);
+            continue;
+        }
+        if ((features & I2C_FEATURE_PEC) && i2c_multi->pec_active)
+            i2c_multi->crc = i2c_multi_crc8_table[i2c_multi->crc ^ *i2c_multi->buffer];
+        write_fifo_put(i2c_multi, *i2c_multi->buffer++);
+        if ((features & I2C_FEATURE_REGISTER_MAPS) && i2c_multi->buffer == i2c_multi->buffer_end)
+            i2c_multi->buffer = i2c_multi->registers;
+    }
+}
+
+static __force_inline void write_fifo_put(i2c_multi_t *i2c_multi, uint8_t data) {
+    // Kept until the state machine pulls it, to be traced when it goes out
+    i2c_multi->queued[i2c_multi->bytes_queued++ % FIFO_DEPTH] = data;
+    pio_sm_put(i2c_multi->pio, i2c_multi->sm, (uint32_t)data << 24);
+}
+
+static __force_inline void write_fifo_pad(i2c_multi_t *i2c_multi) {
+    // Past the end of the data. The state machine holds SCL on an empty FIFO, so the end is sent explicitly
+    pio_sm_put(i2c_multi->pio, i2c_multi->sm, WRITE_PAD);
+    i2c_multi->bytes_padded++;
+}
+
+static __force_inline void receive_ring_stop(i2c_multi_t *i2c_multi) {
+    dma_channel_abort(i2c_multi->dma_receive);
+    i2c_multi->bytes_count += RECEIVE_RING_COUNT - dma_channel_hw_addr(i2c_multi->dma_receive)->transfer_count;
+    pio_set_irq0_source_enabled(i2c_multi->pio, pis_interrupt0, false);
+    pio_set_irq0_source_enabled(i2c_multi->pio, (pio_interrupt_source_t)(pis_sm0_rx_fifo_not_empty + i2c_multi->sm),
+                                true);
+    i2c_multi->receive_ring_busy = false;
+}
+
+static __force_inline uint8_t receive_ring_take_last(i2c_multi_t *i2c_multi) {
+    // The address of the next transfer, moved to the ring with the data. Given back so the ring only holds data
+    uint16_t mask = (1 << i2c_multi->receive_ring_bits) - 1;
+    uint16_t last = (dma_channel_hw_addr(i2c_multi->dma_receive)->write_addr - (uintptr_t)i2c_multi->receive_ring - 1) &
+                    mask;
+    dma_channel_set_write_addr(i2c_multi->dma_receive, &i2c_multi->receive_ring[last], false);
+    i2c_multi->bytes_count--;
+    return i2c_multi->receive_ring[last];
+}
+
+static __force_inline void write_dma_start(i2c_multi_t *i2c_multi) {
+    dma_channel_set_trans_count(i2c_multi->dma_write,
+                                i2c_multi->transfer_length < 0 ? WRITE_DMA_COUNT : (uint32_t)i2c_multi->transfer_length,
+                                false);
+    // The pad channel is chained, started only once the data is all queued
+    dma_channel_set_trans_count(i2c_multi->dma_pad, WRITE_DMA_COUNT, false);
+    dma_channel_set_read_addr(i2c_multi->dma_write, i2c_multi->buffer, true);
+    i2c_multi->write_dma_busy = true;
+}
+
+static __force_inline void write_dma_stop(i2c_multi_t *i2c_multi) {
+    // Data first, so that a chain triggered meanwhile is aborted too
+    dma_channel_abort(i2c_multi->dma_write);
+    dma_channel_abort(i2c_multi->dma_pad);
+    // A byte is pulled only after the master acks the previous one, so what is left in the FIFO was not sent. The
+    // pad count is only live once the data count has run out
+    uint32_t queued = dma_channel_hw_addr(i2c_multi->dma_write)->read_addr - (uintptr_t)i2c_multi->buffer;
+    uint32_t padded = 0;
+    if (!dma_channel_hw_addr(i2c_multi->dma_write)->transfer_count)
+        padded = WRITE_DMA_COUNT - dma_channel_hw_addr(i2c_multi->dma_pad)->transfer_count;
+    uint32_t sent = queued + padded - pio_sm_get_tx_fifo_level(i2c_multi->pio, i2c_multi->sm);
+    i2c_multi->bytes_count += sent < queued ? sent : queued;
+    i2c_multi->write_dma_busy = false;
+}
+
+static __force_inline uint64_t event_encode(i2c_multi_t *i2c_multi, event_type_t type, uint8_t data, uint32_t length) {
+    // The address of the transfer goes with every event, a queued one is dispatched after the next address
+    return (uint64_t)i2c_multi->current_address << 48 | (uint64_t)type << 40 | (uint64_t)data << 32 | length;
+}
+
+static __force_inline void report(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_dispatch_t dispatch,
+                                  event_type_t type, uint8_t data, uint32_t length) {
+    uint64_t event = event_encode(i2c_multi, type, data, length);
+    if (!(features & I2C_FEATURE_EVENT_QUEUE) || !i2c_multi->event_queue) {
+        dispatch(i2c_multi, event);
+        return;
+    }
+    // Single producer, single consumer: the interrupt only moves the head and i2c_multi_task(i2c_multi) only the tail
+    uint16_t head = i2c_multi->event_head;
+    uint16_t next = (head + 1) & i2c_multi->event_mask;
+    if (next == i2c_multi->event_tail) {
+        i2c_multi->events_dropped++;
+        return;
+    }
+    i2c_multi->event_queue[head] = event;
+    __sync_synchronize();
+    i2c_multi->event_head = next;
+    // A full FIFO has announcements pending already
+    if ((features & I2C_FEATURE_CORE1) && i2c_multi->core1 && multicore_fifo_wready())
+        multicore_fifo_push_blocking_inline(pio_get_index(i2c_multi->pio));
+}
+
+static __force_inline void trace_record(i2c_multi_t *i2c_multi, uint32_t features, i2c_multi_trace_type_t type,
+                                        uint8_t data, uint32_t length) {
+    // Timestamped when the CPU sees the event. The oldest entry is overwritten when the buffer is full
+    if (!(features & I2C_FEATURE_TRACE) || !i2c_multi->trace) return;
+    i2c_multi_trace_t *entry = &i2c_multi->trace[i2c_multi->trace_head++ & i2c_multi->trace_mask];
+    entry->time = time_us_32();
+    entry->type = type;
+    entry->data = data;
+    entry->length = length > 0xFFFF ? 0xFFFF : length;
+}
+
+static __force_inline void trace_sent(i2c_multi_t *i2c_multi, uint32_t features, uint32_t pulled) {
+    // A byte is pulled once the master acks the previous one, as it starts going out, so the bytes pulled since the
+    // last call are the ones sent. The FIFO holds 4, they are still in the queued copies. The padding is not recorded
+    if (!(features & I2C_FEATURE_TRACE)) return;
+    uint32_t traced = i2c_multi->bytes_traced;
+    if (pulled > i2c_multi->bytes_queued) pulled = i2c_multi->bytes_queued;
+    i2c_multi->bytes_traced = pulled;
+    if (!i2c_multi->trace) return;
+    while (traced < pulled)
+        trace_record(i2c_multi, features, I2C_TRACE_DATA_SENT, i2c_multi->queued[traced++ % FIFO_DEPTH], 0);
+}
+
+#ifdef I2C_MULTI_STATS
+static __force_inline uint32_t stats_elapsed(uint32_t start) {
+    uint32_t now = systick_hw->cvr;
+    return start >= now ? start - now : start + systick_hw->rvr + 1 - now;
+}
+
+static __force_inline void stats_isr_start(i2c_multi_t *i2c_multi) {
+    i2c_multi->isr_start = systick_hw->cvr;
+    // The byte state machine holds SCL on push until the FIFO is read
+    if (pio_sm_is_rx_fifo_full(i2c_multi->pio, i2c_multi->sm)) i2c_multi->stats.rx_fifo_full++;
+}
+
+static __force_inline void stats_isr_end(i2c_multi_t *i2c_multi) {
+    stats_sample(stats_elapsed(i2c_multi->isr_start), &i2c_multi->stats.isr_count, &i2c_multi->stats.isr_cycles_min,
+                 &i2c_multi->stats.isr_cycles_max, &i2c_multi->stats.isr_cycles);
+}
+
+static __force_inline void stats_hold_after_entry(i2c_multi_t *i2c_multi) {
+    // From the handler entry to the release. SCL was held from the push on, but nothing on the chip timestamps it:
+    // the interrupt latency before the entry, which grows with the time interrupts are masked, is not seen here
+    stats_sample(stats_elapsed(i2c_multi->isr_start), &i2c_multi->stats.hold_after_entry_count,
+                 &i2c_multi->stats.hold_after_entry_cycles_min, &i2c_multi->stats.hold_after_entry_cycles_max,
+                 &i2c_multi->stats.hold_after_entry_cycles);
+}
+
+static __force_inline void stats_sample(uint32_t cycles, uint32_t *count, uint32_t *min, uint32_t *max,
+                                        uint64_t *total) {
+    (*count)++;
+    *total += cycles;
+    if (cycles < *min) *min = cycles;
+    if (cycles > *max) *max = cycles;
+}
+#endif
+
+#ifdef __cplusplus
+}
+// Internal to the handlers
+#undef FIFO_DEPTH
+#undef RECEIVE_RING_COUNT
+#undef WRITE_DMA_COUNT
+#undef WRITE_PAD
+#undef ADDRESS_MARK
+#undef REGISTER_HELD
+#undef HS_MASTER_CODE
+#undef ADDRESS_10BIT_PREFIX
+#undef ADDRESS_10BIT_NONE
+#undef STATS
+#endif
+
+#endif
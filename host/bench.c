@@ -0,0 +1,1127 @@
+/**
+ * -------------------------------------------------------------------------------
+ *
+ * Copyright (c) 2022, Daniel Gorbea
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ *
+ * -------------------------------------------------------------------------------
+ *
+ *  I2C slave multi - host benchmark
+ *
+ *  Runs sdk/i2c_multi.c and the programs assembled from sdk/i2c_multi.pio on
+ *  the PIO simulator against a modelled master, and reports for each clock
+ *  divider the highest SCL frequency with error free transfers, the clock
+ *  stretching per byte and the interrupt cycles per byte
+ *
+ * -------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i2c_master.h"
+#include "i2c_multi.h"
+#include "pico/multicore.h"
+#include "pio_sim.h"
+
+#define PIN 0
+#define ADDRESS_RECEIVE 0x70
+#define ADDRESS_REQUEST 0x71
+#define ADDRESS_DISABLED 0x10
+#define ADDRESS_10BIT 0x2A5
+#define ADDRESS_10BIT_DISABLED 0x2A6  // same upper bits
+#define ADDRESS_10BIT_OTHER 0x1A5     // upper bits not served
+#define ADDRESS_STREAM 0x72       // master writes
+#define ADDRESS_STREAM_READ 0x73  // master reads, a stream has one position for both directions
+#define ADDRESS_PEC 0x74
+#define PEC_COMMAND 0x5C  // written before the read with -i
+#define ADDRESS_REGISTERS 0x75
+#define REGISTER_COUNT 24  // wrapped by every transfer of 2 bytes and more
+#define STREAM_BYTES 300  // past the 255 of an 8-bit count
+#define CHUNK_BYTES 64
+#define MAX_BYTES 64
+#define ROUNDS 3
+#define SCAN_STEP 100000
+#define SCAN_LIMIT 10000000
+#define RESOLUTION 10000
+#define RING_BITS 8
+#define EVENT_BITS 7
+#define TRACE_BITS 9
+#define SNIFF_BITS 12
+#define FS_HZ 400000  // master codes with -H
+
+// Transaction types the ISR cycles are broken down by with -y
+typedef enum transfer_type_t {
+    TYPE_WRITE,
+    TYPE_READ,
+    TYPE_NACKED,
+    TYPE_WRITE_READ,
+    TYPE_10BIT_WRITE,
+    TYPE_10BIT_WRITE_READ,
+    TYPE_STREAM_WRITE,
+    TYPE_STREAM_READ,
+    TYPE_PEC_WRITE,
+    TYPE_PEC_WRITE_READ,
+    TYPE_REGISTER_WRITE,
+    TYPE_REGISTER_WRITE_READ,
+    TYPE_REGISTER_READ,
+    TYPE_COUNT
+} transfer_type_t;
+
+static const char *const type_names[TYPE_COUNT] = {
+    "write", "read", "nacked", "write-read", "10-bit write", "10-bit write-read", "stream write", "stream read",
+    "PEC write", "PEC write-read", "register write", "register write-read", "register read"};
+
+typedef struct bench_config_t {
+    uint32_t sys_hz;
+    uint32_t hold_ns;
+    uint bytes;
+    uint handler_cycles;
+    uint core0_load;  // cycles without interrupts on core0 every millisecond
+    uint32_t single_hz;
+    const char *trace_path;
+    bool verbose, trace, ring, write_dma, armed, address_buffer, combined, batched, deferred, dual,
+        receive_only, sniffer, bus_speed, hs, address_10bit, stream, swap, cycles, core1, pec, devices, registers,
+        flash, own_core1;
+} bench_config_t;
+
+typedef struct bench_result_t {
+    bool pass;
+    const char *error;
+    uint bytes;             // bytes on the bus, addresses included
+    uint64_t cycles;        // total bus time
+    uint64_t stretch;       // cycles SCL was held low by the slave
+    uint64_t stretch_max;   // longest single stretch
+    uint64_t isr_cycles;
+    uint64_t isr_count;
+    uint type_bytes[TYPE_COUNT];
+    uint64_t type_isr_cycles[TYPE_COUNT];
+} bench_result_t;
+
+static bench_config_t config = {.sys_hz = 125000000, .hold_ns = 50, .bytes = 8};
+
+static uint8_t write_buffer[MAX_BYTES + 1];
+static uint8_t received[MAX_BYTES + 1];
+static uint8_t swap_buffers[2][MAX_BYTES];
+static uint8_t ring[NUM_PIOS][1 << RING_BITS] __attribute__((aligned(1 << RING_BITS)));
+static uint8_t batch_buffer[MAX_BYTES];
+static uint8_t pec_batch[MAX_BYTES + 1];
+static uint64_t events[NUM_PIOS][1 << EVENT_BITS];
+static i2c_multi_trace_t trace[NUM_PIOS][1 << TRACE_BITS];
+static uint16_t sniffed[1 << SNIFF_BITS] __attribute__((aligned(2 << SNIFF_BITS)));
+static uint16_t sniff_expected[1 << SNIFF_BITS];
+static uint sniff_count;
+static uint16_t sniff_end;
+static const uint16_t free_instructions[8];
+static const pio_program_t free_program = {.instructions = free_instructions, .length = 8, .origin = -1};
+static i2c_multi_t *slave;  // instance under test
+static uint bus;
+static uint bus_divider;  // set by i2c_multi_set_bus_speed() with -B
+static uint received_count, address_count, request_count, stop_count, repeated_start_count, batch_count;
+static uint8_t last_address, last_request, last_batch_address;
+static uint last_stop_length, last_repeated_start_length, last_batch_length;
+static uint address_10bit_count;
+static uint16_t last_address_10bit;
+static bool last_10bit_read;
+static uint8_t chunks[NUM_PIOS][2][2 * CHUNK_BYTES];
+static uint8_t streamed[STREAM_BYTES];
+static uint streamed_count;
+static uint32_t stream_filled[NUM_PIOS], stream_read[NUM_PIOS];  // stream offsets of the next refill and next read
+static uint pec_error_count;
+static uint8_t registers[NUM_PIOS][REGISTER_COUNT];
+static uint8_t register_model[NUM_PIOS][REGISTER_COUNT];  // what the map should hold
+static i2c_multi_t *core1_slaves[NUM_PIOS];                 // taken on core1 by core1_main() with -C
+static uint register_pointer[NUM_PIOS];                   // where the map pointer should be
+static bool register_pec_refused[NUM_PIOS];               // before the read length was set, with -g -i
+static uint8_t last_pec_address;
+static uint8_t swap_snapshot;  // published from the request handler when set
+static bool swap_busy;
+static uint64_t isr_mark;  // ISR cycles already charged to a transaction type
+// The contexts of the devices of -j are their addresses
+static const uint8_t device_addresses[] = {ADDRESS_RECEIVE,     ADDRESS_REQUEST, ADDRESS_STREAM,
+                                           ADDRESS_STREAM_READ, ADDRESS_PEC,     ADDRESS_REGISTERS};
+static uint device_calls;
+static bool device_misrouted;
+
+static void receive_handler(uint8_t data, bool is_address) {
+    sim_cpu_cycles(config.handler_cycles);
+    if (is_address) {
+        last_address = data;
+        address_count++;
+    } else if (received_count < sizeof(received)) {
+        received[received_count++] = data;
+    }
+}
+
+static void request_handler(uint8_t address) {
+    sim_cpu_cycles(config.handler_cycles);
+    last_request = address;
+    request_count++;
+    if (config.armed && address == ADDRESS_REQUEST) i2c_multi_arm_response(slave, address, write_buffer);
+    if (swap_snapshot) {
+        // A new snapshot published while the read is in progress. The buffer being sent is not handed out
+        uint8_t *back = i2c_multi_get_back_buffer(slave);
+        if (back) memset(back, swap_snapshot, MAX_BYTES);
+        i2c_multi_swap_buffers(slave);
+        swap_busy = !i2c_multi_get_back_buffer(slave);
+        swap_snapshot = 0;
+    }
+}
+
+static void stop_handler(uint32_t length) {
+    sim_cpu_cycles(config.handler_cycles);
+    last_stop_length = length;
+    stop_count++;
+}
+
+static void repeated_start_handler(uint32_t length) {
+    sim_cpu_cycles(config.handler_cycles);
+    last_repeated_start_length = length;
+    repeated_start_count++;
+}
+
+static void receive_buffer_handler(uint8_t address, uint8_t *buffer, uint16_t length) {
+    sim_cpu_cycles(config.handler_cycles);
+    last_batch_address = address;
+    last_batch_length = length;
+    batch_count++;
+}
+
+static void address_10bit_handler(uint16_t address, bool is_read) {
+    sim_cpu_cycles(config.handler_cycles);
+    last_address_10bit = address;
+    last_10bit_read = is_read;
+    address_10bit_count++;
+}
+
+static void pec_error_handler(uint8_t address) {
+    sim_cpu_cycles(config.handler_cycles);
+    last_pec_address = address;
+    pec_error_count++;
+}
+
+// With -j the device handlers check that they are called for the transfer of their address, then log like the
+// global handlers. Each check runs the queued handlers before the next transfer, so the slave still holds its address
+static void device_check(void *context) {
+    device_calls++;
+    if (*(const uint8_t *)context != slave->current_address) device_misrouted = true;
+}
+
+static void device_receive_handler(void *context, uint8_t data, bool is_address) {
+    device_check(context);
+    receive_handler(data, is_address);
+}
+
+static void device_request_handler(void *context, uint8_t address) {
+    device_check(context);
+    request_handler(address);
+}
+
+static void device_stop_handler(void *context, uint32_t length) {
+    device_check(context);
+    stop_handler(length);
+}
+
+static void device_repeated_start_handler(void *context, uint32_t length) {
+    device_check(context);
+    repeated_start_handler(length);
+}
+
+static void device_receive_buffer_handler(void *context, uint8_t address, uint8_t *buffer, uint16_t length) {
+    device_check(context);
+    receive_buffer_handler(address, buffer, length);
+}
+
+static void stream_handler(uint8_t address, uint8_t *chunk, uint16_t length, bool is_read);
+
+static void device_stream_handler(void *context, uint8_t address, uint8_t *chunk, uint16_t length, bool is_read) {
+    device_check(context);
+    stream_handler(address, chunk, length, is_read);
+}
+
+static void device_pec_error_handler(void *context, uint8_t address) {
+    device_check(context);
+    pec_error_handler(address);
+}
+
+static const i2c_multi_device_t device = {device_receive_handler,        device_request_handler,
+                                          device_stop_handler,           device_repeated_start_handler,
+                                          device_receive_buffer_handler, device_stream_handler,
+                                          device_pec_error_handler};
+
+static uint8_t stream_byte(uint32_t offset) { return (uint8_t)(offset * 13 + (offset >> 8)); }
+
+// Received chunks are appended in the order they are handed back, sent chunks are refilled with the stream that
+// follows the other chunk
+static void stream_handler(uint8_t address, uint8_t *chunk, uint16_t length, bool is_read) {
+    sim_cpu_cycles(config.handler_cycles);
+    if (is_read) {
+        for (uint i = 0; i < length; i++) chunk[i] = stream_byte(stream_filled[bus]++);
+        return;
+    }
+    for (uint i = 0; i < length && streamed_count < STREAM_BYTES; i++) streamed[streamed_count++] = chunk[i];
+}
+
+static void reset_log(void) {
+    received_count = address_count = request_count = stop_count = repeated_start_count = batch_count = 0;
+    address_10bit_count = streamed_count = pec_error_count = 0;
+    last_address = last_request = last_batch_address = last_pec_address = 0;
+    last_address_10bit = 0;
+    last_10bit_read = false;
+    last_stop_length = last_repeated_start_length = last_batch_length = 0;
+    memset(batch_buffer, 0, sizeof(batch_buffer));
+    memset(pec_batch, 0, sizeof(pec_batch));
+}
+
+// The transfer just run is charged with the ISR cycles since the previous one. Each check runs the master until the
+// STOP has been served, so nothing spills over into the next transfer
+static void count_bytes(bench_result_t *result, transfer_type_t type, uint bytes) {
+    uint64_t isr_cycles = sim_get_stats()->isr_cycles;
+    result->bytes += bytes;
+    result->type_bytes[type] += bytes;
+    result->type_isr_cycles[type] += isr_cycles - isr_mark;
+    isr_mark = isr_cycles;
+}
+
+// Runs the queued handlers of the instance under test. With its interrupts on core1 they are run by core0 from the
+// FIFO interrupt, once core0 takes interrupts again
+static void settle(void) {
+    // Handlers held back by the core0 load run as soon as its window has passed
+    if (config.core0_load) {
+        while (sim_now() % (config.sys_hz / 1000) < config.core0_load) sim_step();
+        sim_step();
+    }
+    if (!config.deferred) return;
+    if (!config.core1) {
+        i2c_multi_task(slave);
+        return;
+    }
+    while (slave->event_tail != slave->event_head && !sim_fault()) sim_step();
+}
+
+static bool fail(bench_result_t *result, const char *error) {
+    result->pass = false;
+    if (!result->error) result->error = error;
+    return false;
+}
+
+// What the sniffer should have stored for the commands the master completed. The end of a transfer is only stored
+// at the next START
+static void sniff_log(const i2c_master_t *master) {
+    bool address = false;
+    for (uint i = 0; i < master->command_count && config.sniffer; i++) {
+        const i2c_master_command_t *command = &master->commands[i];
+        uint16_t entry = 0;
+        if (!command->done) continue;
+        switch (command->type) {
+            case I2C_CMD_START:
+                entry = sniff_end;
+                sniff_end = I2C_SNIFF_REPEATED_START;
+                address = true;
+                break;
+            case I2C_CMD_WRITE:
+            case I2C_CMD_MASTER_CODE:
+            case I2C_CMD_READ:
+                entry = (address ? 0xFE00 : I2C_SNIFF_DATA) | command->data << 1 | !command->ack;
+                address = false;
+                break;
+            case I2C_CMD_STOP: sniff_end = I2C_SNIFF_STOP; break;
+        }
+        if (entry && sniff_count < (1 << SNIFF_BITS)) sniff_expected[sniff_count++] = entry;
+    }
+}
+
+static bool check_sniffer(i2c_multi_t *sniffer, bench_result_t *result) {
+    if (sniff_count >= (1 << SNIFF_BITS)) return fail(result, "sniffer: ring too small for the run");
+    if (i2c_multi_get_sniffer_head(sniffer) != sniff_count) return fail(result, "sniffer: wrong entry count");
+    if (memcmp(sniffed, sniff_expected, sniff_count * sizeof(uint16_t))) return fail(result, "sniffer: entry mismatch");
+    return true;
+}
+
+static bool check_ring(const uint8_t *data, uint length, uint16_t head) {
+    uint16_t mask = (1 << RING_BITS) - 1;
+    if (received_count || i2c_multi_get_receive_ring_head(slave) != ((head + length) & mask)) return false;
+    for (uint i = 0; i < length; i++)
+        if (ring[bus][(head + i) & mask] != data[i]) return false;
+    return true;
+}
+
+static bool check_batch(uint8_t address, const uint8_t *data, uint length) {
+    return !address_count && !received_count && batch_count == 1 && last_batch_address == address &&
+           last_batch_length == length && !memcmp(batch_buffer, data, length);
+}
+
+static bool check_receive(i2c_master_t *master, bench_result_t *result, const uint8_t *data, uint length) {
+    uint16_t head = i2c_multi_get_receive_ring_head(slave);
+    reset_log();
+    uint acked = i2c_master_write(master, ADDRESS_RECEIVE, data, length);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_WRITE, length + 1);
+    if (master->timed_out) return fail(result, "receive: SCL stretched beyond timeout");
+    if (acked != length + 1) return fail(result, "receive: byte not acknowledged");
+    if (config.batched) {
+        if (!check_batch(ADDRESS_RECEIVE, data, length)) return fail(result, "receive: batch mismatch");
+    } else if (address_count != 1 || last_address != ADDRESS_RECEIVE) {
+        return fail(result, "receive: address not reported");
+    } else if (config.ring) {
+        if (!check_ring(data, length, head)) return fail(result, "receive: ring mismatch");
+    } else if (received_count != length || memcmp(received, data, length)) {
+        return fail(result, "receive: data mismatch");
+    }
+    if (stop_count != 1 || last_stop_length != length) return fail(result, "receive: wrong stop length");
+    return true;
+}
+
+static bool check_request(i2c_master_t *master, bench_result_t *result, uint length) {
+    uint8_t data[MAX_BYTES];
+    reset_log();
+    uint count = i2c_master_read(master, ADDRESS_REQUEST, data, length);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_READ, length + 1);
+    if (master->timed_out) return fail(result, "request: SCL stretched beyond timeout");
+    if (count != length) return fail(result, "request: address not acknowledged");
+    if (request_count != 1 || last_request != ADDRESS_REQUEST) return fail(result, "request: request not reported");
+    if (memcmp(data, write_buffer, length)) return fail(result, "request: data mismatch");
+    if (stop_count != 1 || last_stop_length != length) return fail(result, "request: wrong stop length");
+    return true;
+}
+
+static bool check_rejected_read(i2c_master_t *master, bench_result_t *result, uint length) {
+    uint8_t data[MAX_BYTES];
+    reset_log();
+    uint count = i2c_master_read(master, ADDRESS_REQUEST, data, length);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_NACKED, 1);
+    if (master->timed_out) return fail(result, "rejected read: SCL stretched beyond timeout");
+    if (count) return fail(result, "rejected read: address acknowledged");
+    if (request_count) return fail(result, "rejected read: request reported");
+    return true;
+}
+
+static bool check_combined(i2c_master_t *master, bench_result_t *result, const uint8_t *data, uint length) {
+    uint8_t read[MAX_BYTES];
+    uint16_t head = i2c_multi_get_receive_ring_head(slave);
+    reset_log();
+    uint count = i2c_master_write_read(master, ADDRESS_REQUEST, data, length, read, length);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_WRITE_READ, 2 * length + 2);
+    if (master->timed_out) return fail(result, "combined: SCL stretched beyond timeout");
+    if (count != length) return fail(result, "combined: read address not acknowledged");
+    if (config.batched) {
+        if (!check_batch(ADDRESS_REQUEST, data, length)) return fail(result, "combined: batch mismatch");
+    } else if (address_count != 1 || last_address != ADDRESS_REQUEST) {
+        return fail(result, "combined: address not reported");
+    } else if (config.ring) {
+        if (!check_ring(data, length, head)) return fail(result, "combined: ring mismatch");
+    } else if (received_count != length || memcmp(received, data, length)) {
+        return fail(result, "combined: data mismatch");
+    }
+    if (repeated_start_count != 1 || last_repeated_start_length != length)
+        return fail(result, "combined: repeated start not reported");
+    if (request_count != 1 || last_request != ADDRESS_REQUEST) return fail(result, "combined: request not reported");
+    if (memcmp(read, write_buffer, length)) return fail(result, "combined: read mismatch");
+    if (stop_count != 1 || last_stop_length != length) return fail(result, "combined: wrong stop length");
+    return true;
+}
+
+static bool check_overflow(i2c_master_t *master, bench_result_t *result, const uint8_t *data, uint length) {
+    reset_log();
+    uint acked = i2c_master_write(master, ADDRESS_RECEIVE, data, length + 1);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_WRITE, length + 2);
+    if (master->timed_out) return fail(result, "overflow: SCL stretched beyond timeout");
+    if (acked != length + 1) return fail(result, "overflow: byte past the buffer not rejected");
+    if (!check_batch(ADDRESS_RECEIVE, data, length)) return fail(result, "overflow: batch mismatch");
+    if (stop_count != 1 || last_stop_length != length) return fail(result, "overflow: wrong stop length");
+    return true;
+}
+
+static bool check_disabled(i2c_master_t *master, bench_result_t *result) {
+    uint8_t data = 0x55;
+    reset_log();
+    uint acked = i2c_master_write(master, ADDRESS_DISABLED, &data, 1);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_NACKED, 1);
+    if (master->timed_out) return fail(result, "disabled: SCL stretched beyond timeout");
+    if (acked) return fail(result, "disabled: address acknowledged");
+    if (address_count || received_count) return fail(result, "disabled: data reported");
+    return true;
+}
+
+static bool check_received(const uint8_t *data, uint length, uint16_t head) {
+    if (config.ring) return check_ring(data, length, head);
+    return received_count == length && !memcmp(received, data, length);
+}
+
+static bool check_receive_10bit(i2c_master_t *master, bench_result_t *result, const uint8_t *data, uint length) {
+    uint16_t head = i2c_multi_get_receive_ring_head(slave);
+    reset_log();
+    uint acked = i2c_master_write_10bit(master, ADDRESS_10BIT, data, length);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_10BIT_WRITE, length + 2);
+    if (master->timed_out) return fail(result, "10-bit receive: SCL stretched beyond timeout");
+    if (acked != length + 2) return fail(result, "10-bit receive: byte not acknowledged");
+    if (address_count || address_10bit_count != 1 || last_address_10bit != ADDRESS_10BIT || last_10bit_read)
+        return fail(result, "10-bit receive: address not reported");
+    if (!check_received(data, length, head)) return fail(result, "10-bit receive: data mismatch");
+    if (stop_count != 1 || last_stop_length != length) return fail(result, "10-bit receive: wrong stop length");
+    return true;
+}
+
+static bool check_combined_10bit(i2c_master_t *master, bench_result_t *result, const uint8_t *data, uint length) {
+    uint8_t read[MAX_BYTES];
+    uint16_t head = i2c_multi_get_receive_ring_head(slave);
+    reset_log();
+    uint count = i2c_master_write_read_10bit(master, ADDRESS_10BIT, data, length, read, length);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_10BIT_WRITE_READ, 2 * length + 3);
+    if (master->timed_out) return fail(result, "10-bit combined: SCL stretched beyond timeout");
+    if (count != length) return fail(result, "10-bit combined: read address not acknowledged");
+    if (address_10bit_count != 2 || last_address_10bit != ADDRESS_10BIT || !last_10bit_read)
+        return fail(result, "10-bit combined: address not reported");
+    if (!check_received(data, length, head)) return fail(result, "10-bit combined: data mismatch");
+    if (repeated_start_count != 1 || last_repeated_start_length != length)
+        return fail(result, "10-bit combined: repeated start not reported");
+    if (request_count) return fail(result, "10-bit combined: 7-bit request reported");
+    if (memcmp(read, write_buffer, length)) return fail(result, "10-bit combined: read mismatch");
+    if (stop_count != 1 || last_stop_length != length) return fail(result, "10-bit combined: wrong stop length");
+    return true;
+}
+
+static bool check_disabled_10bit(i2c_master_t *master, bench_result_t *result) {
+    uint8_t data = 0x55;
+    reset_log();
+    // The upper bits are shared with an enabled address: the first byte is acknowledged, the second is not
+    uint acked = i2c_master_write_10bit(master, ADDRESS_10BIT_DISABLED, &data, 1);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_NACKED, 2);
+    if (master->timed_out) return fail(result, "10-bit disabled: SCL stretched beyond timeout");
+    if (acked != 1) return fail(result, "10-bit disabled: lower address bits acknowledged");
+    acked = i2c_master_write_10bit(master, ADDRESS_10BIT_OTHER, &data, 1);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_NACKED, 1);
+    if (acked) return fail(result, "10-bit disabled: upper address bits acknowledged");
+    if (address_10bit_count || received_count || stop_count) return fail(result, "10-bit disabled: data reported");
+    return true;
+}
+
+static bool check_stream_write(i2c_master_t *master, bench_result_t *result) {
+    uint8_t data[STREAM_BYTES];
+    for (uint i = 0; i < STREAM_BYTES; i++) data[i] = (uint8_t)(0x5A + i * 29);
+    reset_log();
+    uint acked = i2c_master_write(master, ADDRESS_STREAM, data, STREAM_BYTES);
+    sniff_log(master);
+    count_bytes(result, TYPE_STREAM_WRITE, STREAM_BYTES + 1);
+    if (master->timed_out) return fail(result, "stream write: SCL stretched beyond timeout");
+    if (acked != STREAM_BYTES + 1) return fail(result, "stream write: byte not acknowledged");
+    if (streamed_count != STREAM_BYTES || memcmp(streamed, data, STREAM_BYTES))
+        return fail(result, "stream write: chunk mismatch");
+    if (stop_count != 1 || last_stop_length != STREAM_BYTES) return fail(result, "stream write: wrong stop length");
+    return true;
+}
+
+static bool check_stream_read(i2c_master_t *master, bench_result_t *result) {
+    uint8_t data[STREAM_BYTES];
+    reset_log();
+    uint count = i2c_master_read(master, ADDRESS_STREAM_READ, data, STREAM_BYTES);
+    sniff_log(master);
+    count_bytes(result, TYPE_STREAM_READ, STREAM_BYTES + 1);
+    if (master->timed_out) return fail(result, "stream read: SCL stretched beyond timeout");
+    if (count != STREAM_BYTES) return fail(result, "stream read: address not acknowledged");
+    // Each read resumes the stream where the previous one stopped
+    for (uint i = 0; i < STREAM_BYTES; i++)
+        if (data[i] != stream_byte(stream_read[bus]++)) return fail(result, "stream read: data mismatch");
+    if (stop_count != 1 || last_stop_length != STREAM_BYTES) return fail(result, "stream read: wrong stop length");
+    return true;
+}
+
+// Bit by bit, to check the table of the library
+static uint8_t crc8(uint8_t crc, uint8_t byte) {
+    crc ^= byte;
+    for (uint i = 0; i < 8; i++) crc = crc & 0x80 ? crc << 1 ^ 0x07 : crc << 1;
+    return crc;
+}
+
+// A write with a good PEC, then with a bad one, which is reported, and nacked when it ends a receive buffer. The
+// read after the command is answered with the PEC over the whole transaction
+static bool check_pec(i2c_master_t *master, bench_result_t *result, const uint8_t *data, uint length) {
+    uint8_t message[MAX_BYTES + 1], read[MAX_BYTES + 1];
+    uint8_t pec = crc8(0, ADDRESS_PEC << 1);
+    for (uint i = 0; i < length; i++) pec = crc8(pec, message[i] = data[i]);
+    for (uint bad = 0; bad < 2; bad++) {
+        bool nacked = bad && config.batched;
+        message[length] = pec ^ bad;
+        reset_log();
+        uint acked = i2c_master_write(master, ADDRESS_PEC, message, length + 1);
+        sniff_log(master);
+        settle();
+        count_bytes(result, TYPE_PEC_WRITE, length + 2);
+        if (master->timed_out) return fail(result, "PEC: SCL stretched beyond timeout");
+        if (acked != length + 2 - nacked)
+            return fail(result, nacked ? "PEC: bad PEC acknowledged" : "PEC: byte not acknowledged");
+        if (pec_error_count != bad || (bad && last_pec_address != ADDRESS_PEC))
+            return fail(result, bad ? "PEC: bad PEC not reported" : "PEC: good PEC reported");
+        if (config.batched ? batch_count != 1 || last_batch_address != ADDRESS_PEC ||
+                                 last_batch_length != length + !nacked || memcmp(pec_batch, message, length + !nacked)
+                           : received_count != length + 1 || memcmp(received, message, length + 1))
+            return fail(result, "PEC: data mismatch");
+        if (stop_count != 1 || last_stop_length != length + !nacked) return fail(result, "PEC: wrong stop length");
+    }
+    if (config.receive_only) return true;
+    uint8_t command = PEC_COMMAND;
+    reset_log();
+    uint count = i2c_master_write_read(master, ADDRESS_PEC, &command, 1, read, length + 1);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_PEC_WRITE_READ, length + 4);
+    if (master->timed_out) return fail(result, "PEC read: SCL stretched beyond timeout");
+    if (count != length + 1) return fail(result, "PEC read: read address not acknowledged");
+    pec = crc8(crc8(crc8(0, ADDRESS_PEC << 1), command), ADDRESS_PEC << 1 | 1);
+    for (uint i = 0; i < length; i++) pec = crc8(pec, write_buffer[i]);
+    if (memcmp(read, write_buffer, length)) return fail(result, "PEC read: read mismatch");
+    if (read[length] != pec) return fail(result, "PEC read: wrong PEC sent");
+    if (pec_error_count) return fail(result, "PEC read: error reported");
+    if (stop_count != 1 || last_stop_length != length + 1) return fail(result, "PEC read: wrong stop length");
+    return true;
+}
+
+// A pointer then data wrapping at the end of the map, the pointer then a read after a repeated START, and a read that
+// goes on from the pointer left by the previous one. Both wrap for 2 bytes and more. With -i every transfer ends with
+// a PEC, the reads after the read length, and a write of one register with a bad PEC is stored and reported
+static bool check_registers(i2c_master_t *master, bench_result_t *result, const uint8_t *data, uint length) {
+    uint8_t message[MAX_BYTES + 2], read[MAX_BYTES + 1];
+    uint pec = config.pec;
+    uint pointer = REGISTER_COUNT - (length + 1) / 2;
+    message[0] = pointer;
+    for (uint i = 0; i < length; i++) register_model[bus][(pointer + i) % REGISTER_COUNT] = message[i + 1] = data[i];
+    uint8_t crc = crc8(0, ADDRESS_REGISTERS << 1);
+    for (uint i = 0; i <= length; i++) crc = crc8(crc, message[i]);
+    message[length + 1] = crc;
+    register_pointer[bus] = (pointer + length) % REGISTER_COUNT;
+    reset_log();
+    uint acked = i2c_master_write(master, ADDRESS_REGISTERS, message, length + 1 + pec);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_REGISTER_WRITE, length + 2 + pec);
+    if (master->timed_out) return fail(result, "registers: SCL stretched beyond timeout");
+    if (acked != length + 2 + pec) return fail(result, "registers: byte not acknowledged");
+    if (address_count != 1 || last_address != ADDRESS_REGISTERS || received_count)
+        return fail(result, "registers: data bytes reported");
+    if (memcmp(registers[bus], register_model[bus], REGISTER_COUNT)) return fail(result, "registers: map mismatch");
+    if (stop_count != 1 || last_stop_length != length + 1 + pec) return fail(result, "registers: wrong stop length");
+    if (pec_error_count) return fail(result, "registers: good PEC reported");
+
+    if (pec) {
+        message[0] = REGISTER_COUNT - 1;
+        message[1] = register_model[bus][REGISTER_COUNT - 1] = data[0] ^ 0xFF;
+        message[2] = crc8(crc8(crc8(0, ADDRESS_REGISTERS << 1), message[0]), message[1]) ^ 1;
+        reset_log();
+        acked = i2c_master_write(master, ADDRESS_REGISTERS, message, 3);
+        sniff_log(master);
+        settle();
+        count_bytes(result, TYPE_REGISTER_WRITE, 4);
+        if (master->timed_out) return fail(result, "registers bad PEC: SCL stretched beyond timeout");
+        if (acked != 4) return fail(result, "registers bad PEC: byte not acknowledged");
+        if (pec_error_count != 1 || last_pec_address != ADDRESS_REGISTERS)
+            return fail(result, "registers bad PEC: not reported");
+        if (memcmp(registers[bus], register_model[bus], REGISTER_COUNT))
+            return fail(result, "registers bad PEC: map mismatch");
+    }
+    if (config.receive_only) return true;
+
+    uint8_t command = pointer - 1;
+    reset_log();
+    uint count = i2c_master_write_read(master, ADDRESS_REGISTERS, &command, 1, read, length + pec);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_REGISTER_WRITE_READ, length + 3 + pec);
+    if (master->timed_out) return fail(result, "registers read: SCL stretched beyond timeout");
+    if (count != length + pec) return fail(result, "registers read: read address not acknowledged");
+    crc = crc8(crc8(crc8(0, ADDRESS_REGISTERS << 1), command), ADDRESS_REGISTERS << 1 | 1);
+    for (uint i = 0; i < length; i++) {
+        if (read[i] != register_model[bus][(command + i) % REGISTER_COUNT])
+            return fail(result, "registers read: read mismatch");
+        crc = crc8(crc, read[i]);
+    }
+    if (pec && read[length] != crc) return fail(result, "registers read: wrong PEC sent");
+    if (repeated_start_count != 1 || last_repeated_start_length != 1 || request_count != 1)
+        return fail(result, "registers read: repeated start not reported");
+    if (stop_count != 1 || last_stop_length != length + pec)
+        return fail(result, "registers read: wrong stop length");
+
+    register_pointer[bus] = (command + length) % REGISTER_COUNT;
+    reset_log();
+    count = i2c_master_read(master, ADDRESS_REGISTERS, read, length + pec);
+    sniff_log(master);
+    settle();
+    count_bytes(result, TYPE_REGISTER_READ, length + 1 + pec);
+    if (master->timed_out) return fail(result, "registers sequential read: SCL stretched beyond timeout");
+    if (count != length + pec) return fail(result, "registers sequential read: address not acknowledged");
+    crc = crc8(0, ADDRESS_REGISTERS << 1 | 1);
+    for (uint i = 0; i < length; i++) {
+        if (read[i] != register_model[bus][(register_pointer[bus] + i) % REGISTER_COUNT])
+            return fail(result, "registers sequential read: not from the kept pointer");
+        crc = crc8(crc, read[i]);
+    }
+    if (pec && read[length] != crc) return fail(result, "registers sequential read: wrong PEC sent");
+    if (stop_count != 1 || last_stop_length != length + pec)
+        return fail(result, "registers sequential read: wrong stop length");
+    return true;
+}
+
+static bool check_swap(i2c_master_t *master, bench_result_t *result, uint length) {
+    uint8_t data[MAX_BYTES], expected[MAX_BYTES];
+    i2c_multi_set_write_buffer(slave, swap_buffers[0]);
+    i2c_multi_set_back_buffer(slave, swap_buffers[1]);
+    uint8_t *back = i2c_multi_get_back_buffer(slave);
+    if (!back) return fail(result, "swap: back buffer busy while idle");
+    memset(back, 0xA1, MAX_BYTES);
+    i2c_multi_swap_buffers(slave);
+    // The read latched the 0xA1 snapshot before the request handler published 0xB2. Bit 7 set, see -l
+    reset_log();
+    swap_snapshot = 0xB2;
+    swap_busy = false;
+    uint count = i2c_master_read(master, ADDRESS_RECEIVE, data, length);
+    sniff_log(master);
+    count_bytes(result, TYPE_READ, length + 1);
+    memset(expected, 0xA1, length);
+    if (master->timed_out) return fail(result, "swap: SCL stretched beyond timeout");
+    if (count != length || memcmp(data, expected, length))
+        return fail(result, "swap: read not from the latched buffer");
+    if (!swap_busy) return fail(result, "swap: buffer being sent handed out");
+    if (!i2c_multi_get_back_buffer(slave)) return fail(result, "swap: back buffer busy after the read");
+    reset_log();
+    count = i2c_master_read(master, ADDRESS_RECEIVE, data, length);
+    sniff_log(master);
+    count_bytes(result, TYPE_READ, length + 1);
+    memset(expected, 0xB2, length);
+    if (count != length || memcmp(data, expected, length)) return fail(result, "swap: new snapshot not sent");
+    i2c_multi_set_write_buffer(slave, write_buffer);
+    i2c_multi_set_back_buffer(slave, NULL);
+    return true;
+}
+
+static i2c_multi_t *slave_init(PIO pio, uint pin, uint index) {
+    i2c_multi_t *i2c_multi = config.receive_only ? i2c_multi_init_receive_only(pio, pin) : i2c_multi_init(pio, pin);
+    i2c_multi_enable_address(i2c_multi, ADDRESS_RECEIVE);
+    i2c_multi_enable_address(i2c_multi, ADDRESS_REQUEST);
+    i2c_multi_set_receive_handler(i2c_multi, receive_handler);
+    i2c_multi_set_request_handler(i2c_multi, request_handler);
+    i2c_multi_set_stop_handler(i2c_multi, stop_handler);
+    i2c_multi_set_repeated_start_handler(i2c_multi, repeated_start_handler);
+    if (config.address_buffer)
+        i2c_multi_set_address_buffer(i2c_multi, ADDRESS_REQUEST, write_buffer, -1);
+    else
+        i2c_multi_set_write_buffer(i2c_multi, write_buffer);
+    if (config.ring) i2c_multi_set_receive_ring(i2c_multi, ring[index], RING_BITS);
+    if (config.deferred) i2c_multi_set_event_queue(i2c_multi, events[index], EVENT_BITS);
+    if (config.trace_path) i2c_multi_set_trace(i2c_multi, trace[index], TRACE_BITS);
+    if (config.batched) {
+        i2c_multi_set_receive_buffer(i2c_multi, ADDRESS_RECEIVE, batch_buffer, config.bytes);
+        i2c_multi_set_receive_buffer(i2c_multi, ADDRESS_REQUEST, batch_buffer, config.bytes);
+        if (!config.devices) i2c_multi_set_receive_buffer_handler(i2c_multi, receive_buffer_handler);
+    }
+    if (config.write_dma) i2c_multi_set_write_dma(i2c_multi, true);
+    if (config.address_10bit) {
+        // 10-bit reads are answered from the write buffer, also with -b
+        i2c_multi_enable_address_10bit(i2c_multi, ADDRESS_10BIT);
+        i2c_multi_set_address_10bit_handler(i2c_multi, address_10bit_handler);
+        i2c_multi_set_write_buffer(i2c_multi, write_buffer);
+    }
+    if (config.stream) {
+        for (uint i = 0; i < 2 * CHUNK_BYTES; i++) chunks[index][1][i] = stream_byte(i);
+        stream_filled[index] = 2 * CHUNK_BYTES;
+        stream_read[index] = 0;
+        i2c_multi_enable_address(i2c_multi, ADDRESS_STREAM);
+        i2c_multi_enable_address(i2c_multi, ADDRESS_STREAM_READ);
+        i2c_multi_set_stream(i2c_multi, ADDRESS_STREAM, chunks[index][0], CHUNK_BYTES);
+        i2c_multi_set_stream(i2c_multi, ADDRESS_STREAM_READ, chunks[index][1], CHUNK_BYTES);
+        if (!config.devices) i2c_multi_set_stream_handler(i2c_multi, stream_handler);
+    }
+    if (config.pec) {
+        // Read with a fixed length, the PEC is sent after it
+        i2c_multi_enable_address(i2c_multi, ADDRESS_PEC);
+        i2c_multi_set_pec(i2c_multi, ADDRESS_PEC, true);
+        i2c_multi_set_address_buffer(i2c_multi, ADDRESS_PEC, write_buffer, config.bytes);
+        if (!config.devices) i2c_multi_set_pec_error_handler(i2c_multi, pec_error_handler);
+        if (config.batched) i2c_multi_set_receive_buffer(i2c_multi, ADDRESS_PEC, pec_batch, config.bytes + 1);
+    }
+    if (config.registers) {
+        for (uint i = 0; i < REGISTER_COUNT; i++)
+            registers[index][i] = register_model[index][i] = (uint8_t)(0xA5 ^ i * 11);
+        i2c_multi_enable_address(i2c_multi, ADDRESS_REGISTERS);
+        i2c_multi_set_register_map(i2c_multi, ADDRESS_REGISTERS, registers[index], REGISTER_COUNT);
+        // Reads of the map only have an end, to send the PEC after, once a read length is set
+        if (config.pec) {
+            register_pec_refused[index] = !i2c_multi_set_pec(i2c_multi, ADDRESS_REGISTERS, true);
+            i2c_multi_set_register_read_length(i2c_multi, ADDRESS_REGISTERS, config.bytes);
+            i2c_multi_set_pec(i2c_multi, ADDRESS_REGISTERS, true);
+        }
+        // An empty map leaves the receive address as it was, the receive checks would divide by its size otherwise
+        i2c_multi_set_register_map(i2c_multi, ADDRESS_RECEIVE, registers[index], 0);
+    }
+    // The global handlers are left for the 10-bit addresses. The receive buffer, stream and PEC error ones are not set
+    // with -j, so those events can only reach the devices
+    for (uint i = 0; i < sizeof(device_addresses) && config.devices; i++)
+        i2c_multi_set_device(i2c_multi, device_addresses[i], &device, (void *)&device_addresses[i]);
+    if (config.armed) i2c_multi_arm_response(i2c_multi, ADDRESS_REQUEST, write_buffer);
+    if (config.own_core1) {
+        i2c_multi_prepare_core1(i2c_multi, true);
+        core1_slaves[index] = i2c_multi;
+    } else if (config.core1) {
+        i2c_multi_set_core1(i2c_multi, true);
+    }
+    return i2c_multi;
+}
+
+// core1 of the application with -C: it takes the interrupts of the buses left by core0, then sleeps between them
+static void core1_main(void) {
+    for (uint i = 0; i < NUM_PIOS; i++)
+        if (core1_slaves[i]) i2c_multi_enable_core1_irq(core1_slaves[i], true);
+    while (true) __wfi();
+}
+
+#ifdef I2C_MULTI_STATS
+static void print_stats(i2c_multi_t *i2c_multi, uint index) {
+    const i2c_multi_stats_t *stats = i2c_multi_get_stats(i2c_multi);
+    double ns_per_cycle = 1e9 / config.sys_hz;
+    printf("  bus %u: transactions 0x%02X %u, 0x%02X %u, nacked %u, repeated starts %u\n", index, ADDRESS_RECEIVE,
+           stats->transactions[ADDRESS_RECEIVE], ADDRESS_REQUEST, stats->transactions[ADDRESS_REQUEST],
+           stats->nacked_addresses, stats->repeated_starts);
+    printf("  bus %u: bytes received %u, sent %u, RX FIFO full %u, PEC errors %u\n", index, stats->bytes_received,
+           stats->bytes_sent, stats->rx_fifo_full, stats->pec_errors);
+    if (stats->isr_count)
+        printf("  bus %u: ISR cycles min %u avg %.1f max %u (%u calls)\n", index, stats->isr_cycles_min,
+               (double)stats->isr_cycles / stats->isr_count, stats->isr_cycles_max, stats->isr_count);
+    if (stats->hold_after_entry_count)
+        printf("  bus %u: hold after entry min %.0f ns avg %.0f ns max %.0f ns (%u holds)\n", index,
+               stats->hold_after_entry_cycles_min * ns_per_cycle,
+               (double)stats->hold_after_entry_cycles / stats->hold_after_entry_count * ns_per_cycle,
+               stats->hold_after_entry_cycles_max * ns_per_cycle, stats->hold_after_entry_count);
+}
+#endif
+
+static bench_result_t run(uint div, uint32_t scl_hz) {
+    bench_result_t result = {.pass = true};
+    i2c_master_t masters[NUM_PIOS];
+    i2c_multi_t *slaves[NUM_PIOS];
+    i2c_multi_t *sniffer = NULL;
+    uint8_t data[MAX_BYTES + 1];
+    uint buses = config.dual ? 2 : 1;
+
+    sim_reset(config.sys_hz);
+    sim_set_core0_load(config.sys_hz / 1000, config.core0_load);
+    sim_set_flash_handlers(config.flash);
+    if (!config.bus_speed) sim_set_clkdiv_override(div);
+    memset(core1_slaves, 0, sizeof(core1_slaves));
+    for (uint i = 0; i <= MAX_BYTES; i++) write_buffer[i] = (uint8_t)(0x5A ^ (i * 37));
+    for (uint i = 0; i <= MAX_BYTES; i++) data[i] = (uint8_t)(0x3C + i * 71);
+
+    // A second bus on pio1, two pins up, with its own master
+    for (uint i = 0; i < buses; i++) {
+        i2c_master_init(&masters[i], PIN + 2 * i, PIN + 2 * i + 1, config.hs ? FS_HZ : scl_hz, config.hold_ns);
+        if (config.hs) i2c_master_set_hs(&masters[i], scl_hz, 0x08 | i);
+        slaves[i] = slave_init(i ? pio1 : pio0, PIN + 2 * i, i);
+    }
+    if (config.own_core1) multicore_launch_core1(core1_main);
+    // The sniffer listens to the first bus from pio1
+    if (config.sniffer) {
+        sniffer = i2c_multi_init_sniffer(pio1, PIN, sniffed, SNIFF_BITS);
+        sniff_count = 0;
+        sniff_end = I2C_SNIFF_FIRST_START;
+    }
+    // With -B the divider argument is the bus speed the library derives its divider from, with -H the Hs speed
+    for (uint i = 0; i < buses && config.bus_speed; i++) {
+        bus_divider = i2c_multi_set_bus_speed(slaves[i], config.hs ? FS_HZ : div);
+        if (config.hs) bus_divider = i2c_multi_set_hs_speed(slaves[i], div);
+    }
+    if (sniffer && config.bus_speed) i2c_multi_set_bus_speed(sniffer, div);
+    sim_run(1000);
+    sim_clear_stats();
+    isr_mark = 0;
+    device_calls = 0;
+    device_misrouted = false;
+    // The instructions left by the receive only program fit another 8 instruction program, as a UART or WS2812
+    for (uint i = 0; i < buses && config.receive_only; i++)
+        if (!pio_can_add_program(i ? pio1 : pio0, &free_program)) fail(&result, "no room for another program");
+    for (uint i = 0; i < buses && config.registers && config.pec; i++)
+        if (!register_pec_refused[i]) fail(&result, "registers: PEC accepted without a read length");
+
+    uint64_t start = sim_now();
+    for (uint round = 0; round < ROUNDS && result.pass; round++) {
+        for (bus = 0; bus < buses && result.pass; bus++) {
+            i2c_master_t *master = &masters[bus];
+            slave = slaves[bus];
+            if (check_receive(master, &result, data, config.bytes) &&
+                (config.receive_only ? check_rejected_read(master, &result, config.bytes)
+                                     : check_request(master, &result, config.bytes)) &&
+                check_disabled(master, &result)) {
+                if (config.combined && !config.receive_only) check_combined(master, &result, data, config.bytes);
+                if (config.batched && result.pass) check_overflow(master, &result, data, config.bytes);
+                if (config.address_10bit && result.pass && check_receive_10bit(master, &result, data, config.bytes) &&
+                    check_disabled_10bit(master, &result) && config.combined && !config.receive_only)
+                    check_combined_10bit(master, &result, data, config.bytes);
+                if (config.swap && result.pass && !config.receive_only) check_swap(master, &result, config.bytes);
+                if (config.stream && result.pass && check_stream_write(master, &result) && !config.receive_only)
+                    check_stream_read(master, &result);
+                if (config.pec && result.pass) check_pec(master, &result, data, config.bytes);
+                if (config.registers && result.pass) check_registers(master, &result, data, config.bytes);
+            }
+            if (result.pass && sim_fault()) fail(&result, sim_fault());
+            if (result.pass && i2c_multi_get_dropped_events(slave)) fail(&result, "events dropped");
+        }
+    }
+    if (result.pass && config.devices && (!device_calls || device_misrouted))
+        fail(&result, "devices: handler called for another address");
+    result.cycles = sim_now() - start;
+    if (sniffer) {
+        if (result.pass) check_sniffer(sniffer, &result);
+        i2c_multi_remove(sniffer);
+    }
+    if (config.trace_path && config.single_hz) {
+        FILE *file = fopen(config.trace_path, "ab");
+        sim_set_stdio(file);
+        for (uint i = 0; i < buses && file; i++) i2c_multi_dump_trace(slaves[i]);
+        sim_set_stdio(NULL);
+        if (file) fclose(file);
+    }
+    // The interrupts are left by core1 before core0 takes them back to remove the instances
+    if (config.own_core1) multicore_reset_core1();
+    for (uint i = 0; i < buses; i++) {
+        result.stretch += masters[i].stretch_cycles;
+        if (masters[i].stretch_max > result.stretch_max) result.stretch_max = masters[i].stretch_max;
+#ifdef I2C_MULTI_STATS
+        if (config.single_hz) print_stats(slaves[i], i);
+#endif
+        i2c_multi_remove(slaves[i]);
+    }
+    result.isr_cycles = sim_get_stats()->isr_cycles;
+    result.isr_count = sim_get_stats()->isr_count;
+    sim_set_clkdiv_override(0);
+    if (config.verbose)
+        printf("  div %-3u %8.3f MHz  %s%s\n", div, scl_hz / 1e6, result.pass ? "pass" : "FAIL: ",
+               result.pass ? "" : result.error);
+    return result;
+}
+
+static uint32_t max_frequency(uint div, bench_result_t *best) {
+    uint32_t pass = 0, failed = 0;
+    for (uint32_t hz = SCAN_STEP; hz <= SCAN_LIMIT; hz += SCAN_STEP) {
+        bench_result_t result = run(div, hz);
+        if (!result.pass) {
+            failed = hz;
+            break;
+        }
+        pass = hz;
+        *best = result;
+    }
+    if (!failed) return pass;
+    while (failed - pass > RESOLUTION) {
+        uint32_t hz = (pass + failed) / 2 / RESOLUTION * RESOLUTION;
+        if (hz <= pass) break;
+        bench_result_t result = run(div, hz);
+        if (result.pass) {
+            pass = hz;
+            *best = result;
+        } else {
+            failed = hz;
+        }
+    }
+    return pass;
+}
+
+static void usage(const char *name) {
+    printf("usage: %s [options] [divider ...]\n", name);
+    printf("  -s HZ      system clock (default 125000000)\n");
+    printf("  -n BYTES   data bytes per transfer, 1-%u (default 8)\n", MAX_BYTES);
+    printf("  -t NS      master SDA hold time after SCL falls (default 50)\n");
+    printf("  -c CYCLES  cycles spent in each user handler (default 0)\n");
+    printf("  -f HZ      single run at this SCL frequency instead of searching\n");
+    printf("  -r         receive into a DMA ring instead of the receive handler\n");
+    printf("  -w         send the write buffer by DMA\n");
+    printf("  -a         arm the response before the request, rearmed from the request handler\n");
+    printf("  -b         serve the request address from its own buffer instead of the write buffer\n");
+    printf("  -q         add a combined write, repeated start, read transaction to each round\n");
+    printf("  -k         receive into a buffer per address with one handler call per transfer, with overflow\n");
+    printf("  -d         run the handlers from i2c_multi_task(slave) after each transfer instead of the interrupt\n");
+    printf("  -e         add writes to a 10-bit address, and a write, repeated start, read with -q\n");
+    printf("  -l         add a %u byte write and read through a stream of 2 chunks of %u bytes, not with -d\n",
+           STREAM_BYTES, CHUNK_BYTES);
+    printf("  -p         add reads of a write buffer swapped with its back buffer, also during a read, not with -d\n");
+    printf("  -i         add SMBus writes with a good and a bad PEC, and a command then a read with its PEC\n");
+    printf("  -g         add writes and reads of a map of %u registers, wrapping at its end, with a PEC with -i\n",
+           REGISTER_COUNT);
+    printf("  -j         register the handlers per address with a context, the global ones only serve 10-bit,\n");
+    printf("             the receive buffer, stream and PEC error ones are left unset\n");
+    printf("  -o         load the receive only program, master reads are rejected\n");
+    printf("  -2         run a second bus on pio1 (pins 2 and 3) alternating with the first\n");
+    printf("  -1         take the interrupts on core1, the queued handlers of -d run on core0 from the FIFO IRQ\n");
+    printf("  -C         as -1, with core1 run by the benchmark, which takes the interrupts itself\n");
+    printf("  -u CYCLES  core0 takes no interrupts for CYCLES every millisecond, as with USB or flash work\n");
+    printf("  -m         sniff the bus from pio1 and check every byte, ACK and end of transfer it stored\n");
+    printf("  -T FILE    record the bus trace and append its dump to FILE (with -f), see i2c_multi_trace_decode\n");
+    printf("  -x         trace state machine instructions to stderr (with -f)\n");
+    printf("  -B         the arguments are bus speeds in Hz, set with i2c_multi_set_bus_speed() instead of dividers\n");
+    printf("  -H         the arguments are Hs-mode speeds set with i2c_multi_set_hs_speed(), each transfer starting\n");
+    printf("             with a master code at %u kHz. The searched or -f frequency is the Hs SCL\n", FS_HZ / 1000);
+    printf("  -z         charge the handlers as run from flash, as if no function were placed in RAM\n");
+    printf("  -y         break the ISR cycles per byte down by transaction type\n");
+    printf("  -v         print every run\n");
+    printf("dividers default to 1 2 4 8 16 32, bus speeds to 100000 400000 1000000, Hs speeds to 1700000 3400000\n");
+}
+
+int main(int argc, char **argv) {
+    uint dividers[16] = {1, 2, 4, 8, 16, 32};
+    uint divider_count = 6, custom = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) {
+            config.verbose = true;
+        } else if (!strcmp(argv[i], "-r")) {
+            config.ring = true;
+        } else if (!strcmp(argv[i], "-w")) {
+            config.write_dma = true;
+        } else if (!strcmp(argv[i], "-a")) {
+            config.armed = true;
+        } else if (!strcmp(argv[i], "-b")) {
+            config.address_buffer = true;
+        } else if (!strcmp(argv[i], "-q")) {
+            config.combined = true;
+        } else if (!strcmp(argv[i], "-k")) {
+            config.batched = true;
+        } else if (!strcmp(argv[i], "-d")) {
+            config.deferred = true;
+        } else if (!strcmp(argv[i], "-e")) {
+            config.address_10bit = true;
+        } else if (!strcmp(argv[i], "-l")) {
+            config.stream = true;
+        } else if (!strcmp(argv[i], "-p")) {
+            config.swap = true;
+        } else if (!strcmp(argv[i], "-i")) {
+            config.pec = true;
+        } else if (!strcmp(argv[i], "-g")) {
+            config.registers = true;
+        } else if (!strcmp(argv[i], "-j")) {
+            config.devices = true;
+        } else if (!strcmp(argv[i], "-o")) {
+            config.receive_only = true;
+        } else if (!strcmp(argv[i], "-m")) {
+            config.sniffer = true;
+        } else if (!strcmp(argv[i], "-2")) {
+            config.dual = true;
+        } else if (!strcmp(argv[i], "-1")) {
+            config.core1 = true;
+        } else if (!strcmp(argv[i], "-C")) {
+            config.core1 = config.own_core1 = true;
+        } else if (!strcmp(argv[i], "-T") && i + 1 < argc) {
+            config.trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "-B")) {
+            config.bus_speed = true;
+        } else if (!strcmp(argv[i], "-H")) {
+            config.bus_speed = config.hs = true;
+        } else if (!strcmp(argv[i], "-y")) {
+            config.cycles = true;
+        } else if (!strcmp(argv[i], "-z")) {
+            config.flash = true;
+        } else if (!strcmp(argv[i], "-x")) {
+            config.trace = true;
+        } else if (argv[i][0] == '-' && i + 1 < argc && strchr("sntcfu", argv[i][1]) && !argv[i][2]) {
+            unsigned long value = strtoul(argv[++i], NULL, 0);
+            switch (argv[i - 1][1]) {
+                case 's': config.sys_hz = value; break;
+                case 'n': config.bytes = value; break;
+                case 't': config.hold_ns = value; break;
+                case 'c': config.handler_cycles = value; break;
+                case 'f': config.single_hz = value; break;
+                case 'u': config.core0_load = value; break;
+            }
+        } else if (argv[i][0] != '-' && custom < 16) {
+            dividers[custom++] = strtoul(argv[i], NULL, 0);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (custom) {
+        divider_count = custom;
+    } else if (config.hs) {
+        dividers[0] = 1700000;
+        dividers[1] = 3400000;
+        divider_count = 2;
+    } else if (config.bus_speed) {
+        dividers[0] = 100000;
+        dividers[1] = 400000;
+        dividers[2] = 1000000;
+        divider_count = 3;
+    }
+    if (!config.bytes || config.bytes > MAX_BYTES || (config.sniffer && config.dual) ||
+        config.core0_load >= config.sys_hz / 1000 ||
+        ((config.stream || config.swap) && config.deferred)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("sys clock %.1f MHz, %u bytes per transfer, SDA hold %u ns, handler %u cycles"
+           "%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s",
+           config.sys_hz / 1e6, config.bytes, config.hold_ns, config.handler_cycles,
+           config.ring ? ", receive ring" : "", config.write_dma ? ", write DMA" : "",
+           config.armed ? ", armed response" : "", config.address_buffer ? ", address buffer" : "",
+           config.combined ? ", repeated start" : "", config.batched ? ", receive buffer" : "",
+           config.deferred ? ", deferred" : "", config.dual ? ", 2 buses" : "",
+           config.receive_only ? ", receive only" : "", config.sniffer ? ", sniffer" : "",
+           config.address_10bit ? ", 10-bit" : "", config.stream ? ", stream" : "",
+           config.swap ? ", buffer swap" : "", config.pec ? ", PEC" : "", config.devices ? ", devices" : "",
+           config.registers ? ", register map" : "", config.flash ? ", from flash" : "",
+           config.own_core1 ? ", core1 of the application" : config.core1 ? ", core1" : "");
+    if (config.core0_load) printf(", core0 load %u cycles/ms", config.core0_load);
+    printf("\n\n");
+    printf("%sCLK_DIV  max SCL     effective   stretch/byte  max stretch   ISR cycles/byte  ISR/byte\n",
+           config.hs ? "Hs speed    " : config.bus_speed ? "bus speed   " : "");
+    for (uint i = 0; i < divider_count; i++) {
+        bench_result_t best = {0};
+        uint32_t hz = config.single_hz;
+        if (config.bus_speed) printf("%6.3f MHz  ", dividers[i] / 1e6);
+        if (hz) {
+            sim_set_trace(config.trace ? stderr : NULL);
+            best = run(dividers[i], hz);
+            sim_set_trace(NULL);
+            if (!best.pass) {
+                printf("%7u  %6.2f MHz  FAIL: %s\n", config.bus_speed ? bus_divider : dividers[i], hz / 1e6,
+                       best.error);
+                continue;
+            }
+        } else {
+            hz = max_frequency(dividers[i], &best);
+        }
+        if (!hz) {
+            printf("%7u  none\n", config.bus_speed ? bus_divider : dividers[i]);
+            continue;
+        }
+        double seconds = (double)best.cycles / config.sys_hz;
+        double ns_per_cycle = 1e9 / config.sys_hz;
+        printf("%7u  %6.2f MHz  %6.2f MHz  %9.0f ns  %8.0f ns  %15.1f  %8.2f\n",
+               config.bus_speed ? bus_divider : dividers[i], hz / 1e6,
+               best.bytes * 9 / seconds / 1e6, best.stretch * ns_per_cycle / best.bytes,
+               best.stretch_max * ns_per_cycle, (double)best.isr_cycles / best.bytes,
+               (double)best.isr_count / best.bytes);
+        for (uint type = 0; type < TYPE_COUNT && config.cycles; type++)
+            if (best.type_bytes[type])
+                printf("%*s%-51s%15.1f\n", config.bus_speed ? 21 : 9, "", type_names[type],
+                       (double)best.type_isr_cycles[type] / best.type_bytes[type]);
+    }
+    return 0;
+}
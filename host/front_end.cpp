@@ -0,0 +1,107 @@
+/**
+ * -------------------------------------------------------------------------------
+ *
+ * Copyright (c) 2022, Daniel Gorbea
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ *
+ * -------------------------------------------------------------------------------
+ *
+ *  I2C slave multi - C++ front end check
+ *
+ *  Builds sdk/i2c_multi.hpp as C++17 and runs a bus of two devices on the PIO
+ *  simulator, through the interrupt handlers built for the bus: a write, a read
+ *  with PEC, a write with a bad PEC and a write to an address not served.
+ *  Returns 1 on the first mismatch
+ *
+ * -------------------------------------------------------------------------------
+ */
+
+#include <cstdio>
+
+#include "i2c_master.h"
+#include "i2c_multi.hpp"
+#include "pio_sim.h"
+
+#define PIN 0
+
+struct sensor {
+    uint8_t last = 0;
+    uint32_t bytes = 0, length = 0;
+    void on_receive(uint8_t data, bool is_address) {
+        if (is_address) return;
+        last = data;
+        bytes++;
+    }
+    void on_stop(uint32_t length) { this->length = length; }
+} sensor_0x70;
+
+struct eeprom {
+    uint32_t requests = 0, pec_errors = 0;
+    void on_request(uint8_t address) { requests++; }
+    void on_pec_error(uint8_t address) { pec_errors++; }
+} eeprom_0x71;
+
+struct fast : i2c_multi::options {
+    static constexpr uint32_t bus_speed = 400000;
+};
+
+using bus = i2c_multi::bus<fast, i2c_multi::device<0x70, sensor_0x70>, i2c_multi::device<0x71, eeprom_0x71, true>>;
+
+// Only the paths of the options and of the PEC are built into the handlers
+static_assert(bus::features == (I2C_FEATURE_WRITE | I2C_FEATURE_PEC));
+
+// Handlers not defined are left NULL in the table
+static_assert(i2c_multi::detail::handlers<sensor_0x70>::table.request_handler == nullptr);
+static_assert(i2c_multi::detail::handlers<eeprom_0x71>::table.receive_handler == nullptr);
+
+static uint8_t crc8(uint8_t crc, uint8_t data) {
+    crc ^= data;
+    for (uint i = 0; i < 8; i++) crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    return crc;
+}
+
+static bool check(bool ok, const char *what) {
+    if (!ok) printf("c++ front end: %s\n", what);
+    return ok;
+}
+
+int main() {
+    static uint8_t memory[4] = {0x3C, 0x81, 0x7E, 0xC3};
+    const uint8_t data[3] = {0x5A, 0x12, 0xA5};
+    uint8_t read[5];
+    i2c_master_t master;
+
+    sim_reset(125000000);
+    i2c_multi_t *i2c_multi = bus::init(pio0, PIN);
+    if (!check(i2c_multi != nullptr, "init failed")) return 1;
+    if (!check(i2c_multi->device[0x70] == nullptr, "device table set without an event queue")) return 1;
+    i2c_multi_set_address_buffer(i2c_multi, 0x71, memory, sizeof(memory));
+    i2c_master_init(&master, PIN, PIN + 1, fast::bus_speed, 50);
+    sim_run(1000);
+
+    uint acked = i2c_master_write(&master, 0x70, data, sizeof(data));
+    if (!check(acked == 1 + sizeof(data), "write not acknowledged")) return 1;
+    if (!check(sensor_0x70.bytes == sizeof(data) && sensor_0x70.last == data[2], "on_receive")) return 1;
+    if (!check(sensor_0x70.length == sizeof(data), "on_stop")) return 1;
+
+    uint length = i2c_master_read(&master, 0x71, read, sizeof(read));
+    uint8_t pec = crc8(0, 0x71 << 1 | 1);
+    for (uint i = 0; i < sizeof(memory); i++) pec = crc8(pec, memory[i]);
+    if (!check(length == sizeof(read) && eeprom_0x71.requests == 1, "on_request")) return 1;
+    for (uint i = 0; i < sizeof(memory); i++)
+        if (!check(read[i] == memory[i], "read data mismatch")) return 1;
+    if (!check(read[4] == pec, "PEC mismatch")) return 1;
+
+    const uint8_t bad[2] = {0x5A, (uint8_t)~crc8(crc8(0, 0x71 << 1), 0x5A)};
+    i2c_master_write(&master, 0x71, bad, sizeof(bad));
+    sim_run(1000);
+    if (!check(eeprom_0x71.pec_errors == 1, "on_pec_error")) return 1;
+
+    if (!check(i2c_master_write(&master, 0x72, data, 1) == 0, "address not served acknowledged")) return 1;
+
+    printf("c++ front end: pass\n");
+    return 0;
+}
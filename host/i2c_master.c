@@ -0,0 +1,271 @@
+#include "i2c_master.h"
+
+#include "pio_sim.h"
+
+enum { OP_SDA, OP_SCL_LOW, OP_SCL_RELEASE, OP_WAIT, OP_SAMPLE };
+
+static void op(i2c_master_t *master, uint8_t type, uint32_t arg) {
+    master->ops[master->op_count].type = type;
+    master->ops[master->op_count].arg = arg;
+    master->op_count++;
+}
+
+static void ops_bit(i2c_master_t *master, bool bit) {
+    op(master, OP_WAIT, master->hold);
+    op(master, OP_SDA, bit);
+    op(master, OP_WAIT, master->half_period - master->hold);
+    op(master, OP_SCL_RELEASE, 0);
+    op(master, OP_WAIT, master->half_period / 2);
+    op(master, OP_SAMPLE, 0);
+    op(master, OP_WAIT, master->half_period - master->half_period / 2);
+    op(master, OP_SCL_LOW, 0);
+}
+
+static void load_command(i2c_master_t *master) {
+    i2c_master_command_t *command = &master->commands[master->command];
+    master->op_count = 0;
+    master->op = 0;
+    master->samples = 0;
+    switch (command->type) {
+        case I2C_CMD_START:
+            if (master->scl_low) {  // repeated start
+                op(master, OP_WAIT, master->hold);
+                op(master, OP_SDA, 1);
+                op(master, OP_WAIT, master->half_period - master->hold);
+                op(master, OP_SCL_RELEASE, 0);
+            }
+            op(master, OP_WAIT, master->half_period / 2);
+            op(master, OP_SDA, 0);
+            op(master, OP_WAIT, master->half_period / 2);
+            op(master, OP_SCL_LOW, 0);
+            break;
+        case I2C_CMD_WRITE:
+        case I2C_CMD_MASTER_CODE:
+            for (int i = 7; i >= 0; i--) ops_bit(master, command->data & (1 << i));
+            ops_bit(master, 1);
+            break;
+        case I2C_CMD_READ:
+            for (int i = 0; i < 8; i++) ops_bit(master, 1);
+            ops_bit(master, !command->ack);
+            break;
+        case I2C_CMD_STOP:
+            op(master, OP_WAIT, master->hold);
+            op(master, OP_SDA, 0);
+            op(master, OP_WAIT, master->half_period - master->hold);
+            op(master, OP_SCL_RELEASE, 0);
+            op(master, OP_WAIT, master->half_period / 2);
+            op(master, OP_SDA, 1);
+            op(master, OP_WAIT, 2 * master->half_period);
+            break;
+    }
+}
+
+static void set_speed(i2c_master_t *master, uint32_t half_period) {
+    master->half_period = half_period;
+    master->hold = master->fs_hold < half_period ? master->fs_hold : half_period - 1;
+}
+
+static void finish_command(i2c_master_t *master) {
+    i2c_master_command_t *command = &master->commands[master->command];
+    command->done = true;
+    if (command->type == I2C_CMD_WRITE) {
+        command->ack = !(master->samples & 1);
+        if (!command->ack)
+            while (master->command + 1 < master->command_count &&
+                   master->commands[master->command + 1].type != I2C_CMD_STOP)
+                master->command++;
+    } else if (command->type == I2C_CMD_MASTER_CODE) {
+        // Acknowledged by a slave: the transfer is aborted. Otherwise the rest runs at the Hs speed
+        command->ack = !(master->samples & 1);
+        if (command->ack)
+            while (master->command + 1 < master->command_count &&
+                   master->commands[master->command + 1].type != I2C_CMD_STOP)
+                master->command++;
+        else
+            set_speed(master, master->hs_half_period);
+    } else if (command->type == I2C_CMD_READ) {
+        command->data = master->samples >> 1;
+    } else if (command->type == I2C_CMD_STOP) {
+        set_speed(master, master->fs_half_period);
+    }
+    master->command++;
+    if (master->command < master->command_count) load_command(master);
+}
+
+static void tick(void *context) {
+    i2c_master_t *master = context;
+    uint64_t now = sim_now();
+    if (master->command >= master->command_count) return;
+    if (master->waiting_scl) {
+        if (!sim_line(master->scl)) {
+            if (now - master->released_at > master->stretch_timeout) {
+                master->timed_out = true;
+                master->command = master->command_count;
+            }
+            return;
+        }
+        uint64_t stretch = now - master->released_at - 1;
+        master->stretch_cycles += stretch;
+        if (stretch > master->stretch_max) master->stretch_max = stretch;
+        master->waiting_scl = false;
+    }
+    if (now < master->until) return;
+    while (master->command < master->command_count) {
+        if (master->op >= master->op_count) {
+            finish_command(master);
+            continue;
+        }
+        i2c_master_op_t *o = &master->ops[master->op++];
+        switch (o->type) {
+            case OP_SDA: sim_drive_low(master->sda, !o->arg); break;
+            case OP_SCL_LOW:
+                sim_drive_low(master->scl, true);
+                master->scl_low = true;
+                break;
+            case OP_SCL_RELEASE:
+                sim_drive_low(master->scl, false);
+                master->scl_low = false;
+                master->waiting_scl = true;
+                master->released_at = now;
+                return;
+            case OP_WAIT:
+                if (!o->arg) break;
+                master->until = now + o->arg;
+                return;
+            case OP_SAMPLE: master->samples = (master->samples << 1) | sim_line(master->sda); break;
+        }
+    }
+}
+
+void i2c_master_init(i2c_master_t *master, uint sda, uint scl, uint32_t scl_hz, uint32_t hold_ns) {
+    master->sda = sda;
+    master->scl = scl;
+    master->half_period = sim_sys_hz() / scl_hz / 2;
+    if (master->half_period < 2) master->half_period = 2;
+    master->hold = (uint32_t)((uint64_t)hold_ns * sim_sys_hz() / 1000000000u);
+    if (master->hold < 1) master->hold = 1;
+    if (master->hold >= master->half_period) master->hold = master->half_period - 1;
+    master->fs_half_period = master->half_period;
+    master->fs_hold = master->hold;
+    master->hs_half_period = 0;
+    master->stretch_cycles = 0;
+    master->stretch_max = 0;
+    master->stretch_timeout = sim_sys_hz() / 100;  // 10 ms
+    master->timed_out = false;
+    master->command_count = master->command = 0;
+    master->op_count = master->op = 0;
+    master->until = 0;
+    master->waiting_scl = false;
+    master->scl_low = false;
+    sim_drive_low(sda, false);
+    sim_drive_low(scl, false);
+    sim_set_tick_hook(tick, master);
+}
+
+void i2c_master_queue(i2c_master_t *master, i2c_master_command_type_t type, uint8_t data, bool ack) {
+    if (master->command_count >= I2C_MASTER_MAX_COMMANDS) return;
+    i2c_master_command_t *command = &master->commands[master->command_count++];
+    command->type = type;
+    command->data = data;
+    command->ack = ack;
+    command->done = false;
+}
+
+bool i2c_master_idle(const i2c_master_t *master) { return master->command >= master->command_count; }
+
+void i2c_master_set_hs(i2c_master_t *master, uint32_t hs_hz, uint8_t master_code) {
+    master->hs_half_period = hs_hz ? sim_sys_hz() / hs_hz / 2 : 0;
+    if (hs_hz && master->hs_half_period < 2) master->hs_half_period = 2;
+    master->master_code = master_code;
+}
+
+void i2c_master_run(i2c_master_t *master) {
+    if (master->command >= master->command_count) return;
+    sim_set_tick_hook(tick, master);  // the simulator drives one master at a time
+    load_command(master);
+    master->until = sim_now() + 1;
+    while (!i2c_master_idle(master)) sim_step();
+}
+
+static void reset_queue(i2c_master_t *master) { master->command_count = master->command = 0; }
+
+// Queues the START, and the master code with the repeated START in Hs-mode. Returns the index of the address
+static uint queue_start(i2c_master_t *master) {
+    reset_queue(master);
+    i2c_master_queue(master, I2C_CMD_START, 0, false);
+    if (master->hs_half_period) {
+        i2c_master_queue(master, I2C_CMD_MASTER_CODE, master->master_code, false);
+        i2c_master_queue(master, I2C_CMD_START, 0, false);
+    }
+    return master->command_count;
+}
+
+uint i2c_master_write(i2c_master_t *master, uint8_t address, const uint8_t *data, uint length) {
+    uint acked = 0;
+    uint first = queue_start(master);
+    i2c_master_queue(master, I2C_CMD_WRITE, address << 1, false);
+    for (uint i = 0; i < length; i++) i2c_master_queue(master, I2C_CMD_WRITE, data[i], false);
+    i2c_master_queue(master, I2C_CMD_STOP, 0, false);
+    i2c_master_run(master);
+    for (uint i = first; i < master->command_count - 1 && master->commands[i].done && master->commands[i].ack; i++)
+        acked++;
+    return acked;
+}
+
+uint i2c_master_read(i2c_master_t *master, uint8_t address, uint8_t *data, uint length) {
+    uint count = 0;
+    uint first = queue_start(master);
+    i2c_master_queue(master, I2C_CMD_WRITE, address << 1 | 1, false);
+    for (uint i = 0; i < length; i++) i2c_master_queue(master, I2C_CMD_READ, 0, i + 1 < length);
+    i2c_master_queue(master, I2C_CMD_STOP, 0, false);
+    i2c_master_run(master);
+    for (uint i = first + 1; i < master->command_count - 1 && master->commands[i].done; i++)
+        data[count++] = master->commands[i].data;
+    return count;
+}
+
+uint i2c_master_write_read(i2c_master_t *master, uint8_t address, const uint8_t *data, uint length, uint8_t *read,
+                           uint read_length) {
+    uint count = 0;
+    uint first = queue_start(master);
+    i2c_master_queue(master, I2C_CMD_WRITE, address << 1, false);
+    for (uint i = 0; i < length; i++) i2c_master_queue(master, I2C_CMD_WRITE, data[i], false);
+    i2c_master_queue(master, I2C_CMD_START, 0, false);
+    i2c_master_queue(master, I2C_CMD_WRITE, address << 1 | 1, false);
+    for (uint i = 0; i < read_length; i++) i2c_master_queue(master, I2C_CMD_READ, 0, i + 1 < read_length);
+    i2c_master_queue(master, I2C_CMD_STOP, 0, false);
+    i2c_master_run(master);
+    for (uint i = first + length + 3; i < master->command_count - 1 && master->commands[i].done; i++)
+        read[count++] = master->commands[i].data;
+    return count;
+}
+
+uint i2c_master_write_10bit(i2c_master_t *master, uint16_t address, const uint8_t *data, uint length) {
+    uint acked = 0;
+    uint first = queue_start(master);
+    i2c_master_queue(master, I2C_CMD_WRITE, 0xF0 | (address >> 7 & 6), false);
+    i2c_master_queue(master, I2C_CMD_WRITE, address, false);
+    for (uint i = 0; i < length; i++) i2c_master_queue(master, I2C_CMD_WRITE, data[i], false);
+    i2c_master_queue(master, I2C_CMD_STOP, 0, false);
+    i2c_master_run(master);
+    for (uint i = first; i < master->command_count - 1 && master->commands[i].done && master->commands[i].ack; i++)
+        acked++;
+    return acked;
+}
+
+uint i2c_master_write_read_10bit(i2c_master_t *master, uint16_t address, const uint8_t *data, uint length,
+                                 uint8_t *read, uint read_length) {
+    uint count = 0;
+    uint first = queue_start(master);
+    i2c_master_queue(master, I2C_CMD_WRITE, 0xF0 | (address >> 7 & 6), false);
+    i2c_master_queue(master, I2C_CMD_WRITE, address, false);
+    for (uint i = 0; i < length; i++) i2c_master_queue(master, I2C_CMD_WRITE, data[i], false);
+    i2c_master_queue(master, I2C_CMD_START, 0, false);
+    i2c_master_queue(master, I2C_CMD_WRITE, 0xF1 | (address >> 7 & 6), false);
+    for (uint i = 0; i < read_length; i++) i2c_master_queue(master, I2C_CMD_READ, 0, i + 1 < read_length);
+    i2c_master_queue(master, I2C_CMD_STOP, 0, false);
+    i2c_master_run(master);
+    for (uint i = first + length + 4; i < master->command_count - 1 && master->commands[i].done; i++)
+        read[count++] = master->commands[i].data;
+    return count;
+}
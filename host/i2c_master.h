@@ -0,0 +1,94 @@
+#ifndef I2C_MASTER_H
+#define I2C_MASTER_H
+
+// Modelled I2C master for the simulator. It bit-bangs SDA/SCL as open-drain lines from the simulator tick hook, so
+// it keeps its own timing while the slave CPU is busy in an interrupt, and it honours clock stretching.
+//
+// Transfers are queued as commands and run with i2c_master_run(). After a NACK to a written byte the remaining
+// commands up to the next STOP are dropped, like a real master aborting the transfer.
+//
+// With i2c_master_set_hs() every transfer starts in Hs-mode: a master code at the F/S speed, which no slave may
+// acknowledge, then a repeated START and the transfer at the Hs speed until the STOP.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define I2C_MASTER_MAX_COMMANDS 320
+#define I2C_MASTER_MAX_OPS 80
+
+typedef enum i2c_master_command_type_t {
+    I2C_CMD_START,
+    I2C_CMD_WRITE,
+    I2C_CMD_READ,
+    I2C_CMD_STOP,
+    I2C_CMD_MASTER_CODE
+} i2c_master_command_type_t;
+
+typedef struct i2c_master_command_t {
+    i2c_master_command_type_t type;
+    uint8_t data;  // byte to write, or byte read
+    bool ack;      // ACK received after a write, or ACK to send after a read
+    bool done;
+} i2c_master_command_t;
+
+typedef struct i2c_master_op_t {
+    uint8_t type;
+    uint32_t arg;
+} i2c_master_op_t;
+
+typedef struct i2c_master_t {
+    uint sda, scl;
+    uint32_t half_period;     // cycles
+    uint32_t hold;            // cycles from SCL falling to SDA change
+    uint32_t fs_half_period, fs_hold, hs_half_period;
+    uint8_t master_code;
+    uint64_t stretch_cycles;  // cycles the slave held SCL low after the master released it
+    uint64_t stretch_max;     // longest single stretch
+    uint32_t stretch_timeout;
+    bool timed_out;
+    i2c_master_command_t commands[I2C_MASTER_MAX_COMMANDS];
+    uint command_count, command;
+    i2c_master_op_t ops[I2C_MASTER_MAX_OPS];
+    uint op_count, op;
+    uint16_t samples;
+    uint64_t until, released_at;
+    bool waiting_scl, scl_low;
+} i2c_master_t;
+
+void i2c_master_init(i2c_master_t *master, uint sda, uint scl, uint32_t scl_hz, uint32_t hold_ns);
+void i2c_master_queue(i2c_master_t *master, i2c_master_command_type_t type, uint8_t data, bool ack);
+bool i2c_master_idle(const i2c_master_t *master);
+
+// Hs-mode at hs_hz for the following transfers, 0 for F/S only. master_code is 0x08 to 0x0F
+void i2c_master_set_hs(i2c_master_t *master, uint32_t hs_hz, uint8_t master_code);
+
+// Runs the simulator until every queued command has been executed, then clears the queue
+void i2c_master_run(i2c_master_t *master);
+
+// Complete transactions. Return the number of bytes acknowledged by the slave (address included), or read.
+uint i2c_master_write(i2c_master_t *master, uint8_t address, const uint8_t *data, uint length);
+uint i2c_master_read(i2c_master_t *master, uint8_t address, uint8_t *data, uint length);
+
+// Combined transaction: write, repeated start, read. Returns the number of bytes read.
+uint i2c_master_write_read(i2c_master_t *master, uint8_t address, const uint8_t *data, uint length, uint8_t *read,
+                           uint read_length);
+
+// 10-bit address: 1111 0XX0 then the lower 8 bits. Returns the number of bytes acknowledged, both address bytes
+// included
+uint i2c_master_write_10bit(i2c_master_t *master, uint16_t address, const uint8_t *data, uint length);
+
+// 10-bit write, repeated START with 1111 0XX1, read. Returns the number of bytes read.
+uint i2c_master_write_read_10bit(i2c_master_t *master, uint16_t address, const uint8_t *data, uint length,
+                                 uint8_t *read, uint read_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
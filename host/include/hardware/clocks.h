@@ -0,0 +1,31 @@
+#ifndef HOST_HARDWARE_CLOCKS_H
+#define HOST_HARDWARE_CLOCKS_H
+
+// Host stand-in for the clocks API. Every clock runs at the simulated system clock.
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum clock_index {
+    clk_gpout0,
+    clk_gpout1,
+    clk_gpout2,
+    clk_gpout3,
+    clk_ref,
+    clk_sys,
+    clk_peri,
+    clk_usb,
+    clk_adc,
+    clk_rtc
+};
+
+uint32_t clock_get_hz(enum clock_index clk_index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
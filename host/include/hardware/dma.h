@@ -0,0 +1,85 @@
+#ifndef HOST_HARDWARE_DMA_H
+#define HOST_HARDWARE_DMA_H
+
+// Host stand-in for the Pico SDK DMA driver, implemented by the simulator in pio_sim.c. Address registers are
+// pointer sized so that host buffers can be used as transfer targets.
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NUM_DMA_CHANNELS 12
+
+#define DREQ_PIO0_TX0 0
+#define DREQ_PIO0_RX0 4
+#define DREQ_PIO1_TX0 8
+#define DREQ_PIO1_RX0 12
+#define DREQ_FORCE 0x3f
+
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+typedef struct {
+    volatile uintptr_t read_addr;
+    volatile uintptr_t write_addr;
+    io_rw_32 transfer_count;
+    io_rw_32 ctrl_trig;
+} dma_channel_hw_t;
+
+typedef struct {
+    dma_channel_hw_t ch[NUM_DMA_CHANNELS];
+    io_rw_32 ints0, ints1;
+} dma_hw_t;
+
+extern dma_hw_t sim_dma_hw;
+
+#define dma_hw (&sim_dma_hw)
+
+typedef struct {
+    bool read_increment, write_increment, ring_write, bswap, enable, irq_quiet;
+    uint ring_size_bits;
+    uint dreq, chain_to;
+    enum dma_channel_transfer_size size;
+} dma_channel_config;
+
+static inline dma_channel_hw_t *dma_channel_hw_addr(uint channel) { return &dma_hw->ch[channel]; }
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_claim(uint channel);
+void dma_channel_unclaim(uint channel);
+bool dma_channel_is_claimed(uint channel);
+
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to);
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits);
+void channel_config_set_bswap(dma_channel_config *c, bool bswap);
+void channel_config_set_irq_quiet(dma_channel_config *c, bool irq_quiet);
+void channel_config_set_enable(dma_channel_config *c, bool enable);
+
+void dma_channel_set_config(uint channel, const dma_channel_config *config, bool trigger);
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger);
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint32_t transfer_count, bool trigger);
+void dma_channel_start(uint channel);
+void dma_channel_abort(uint channel);
+bool dma_channel_is_busy(uint channel);
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled);
+void dma_channel_set_irq1_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq0_status(uint channel);
+bool dma_channel_get_irq1_status(uint channel);
+void dma_channel_acknowledge_irq0(uint channel);
+void dma_channel_acknowledge_irq1(uint channel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef HOST_HARDWARE_GPIO_H
+#define HOST_HARDWARE_GPIO_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum gpio_override {
+    GPIO_OVERRIDE_NORMAL = 0,
+    GPIO_OVERRIDE_INVERT = 1,
+    GPIO_OVERRIDE_LOW = 2,
+    GPIO_OVERRIDE_HIGH = 3,
+};
+
+void gpio_set_input_enabled(uint gpio, bool enabled);
+bool gpio_get(uint gpio);
+void gpio_set_oeover(uint gpio, uint value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
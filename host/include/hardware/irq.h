@@ -0,0 +1,37 @@
+#ifndef HOST_HARDWARE_IRQ_H
+#define HOST_HARDWARE_IRQ_H
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PIO0_IRQ_0 7
+#define PIO0_IRQ_1 8
+#define PIO1_IRQ_0 9
+#define PIO1_IRQ_1 10
+#define DMA_IRQ_0 11
+#define DMA_IRQ_1 12
+#define SIO_IRQ_PROC0 15
+#define SIO_IRQ_PROC1 16
+
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+
+typedef void (*irq_handler_t)(void);
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+irq_handler_t irq_get_exclusive_handler(uint num);
+// Shared handlers are called in the order they were added, the priority is ignored
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority);
+bool irq_has_shared_handler(uint num);
+void irq_remove_handler(uint num, irq_handler_t handler);
+// The enables are per core, the handlers are shared like the vector table both cores boot with
+void irq_set_enabled(uint num, bool enabled);
+void irq_set_pending(uint num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
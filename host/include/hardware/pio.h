@@ -0,0 +1,139 @@
+#ifndef HOST_HARDWARE_PIO_H
+#define HOST_HARDWARE_PIO_H
+
+// Host stand-in for the Pico SDK PIO driver. The functions are implemented by the simulator in pio_sim.c, which
+// executes the loaded programs cycle by cycle instead of touching registers.
+
+#include "hardware/gpio.h"
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NUM_PIOS 2
+#define NUM_PIO_STATE_MACHINES 4
+#define PIO_INSTRUCTION_COUNT 32
+
+// Only the state machine registers written by DMA are modelled
+typedef struct pio_sm_hw {
+    io_rw_32 instr;
+} pio_sm_hw_t;
+
+typedef struct pio_hw {
+    io_rw_32 txf[NUM_PIO_STATE_MACHINES];
+    io_ro_32 rxf[NUM_PIO_STATE_MACHINES];
+    pio_sm_hw_t sm[NUM_PIO_STATE_MACHINES];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t sim_pio_hw[NUM_PIOS];
+
+#define pio0_hw (&sim_pio_hw[0])
+#define pio1_hw (&sim_pio_hw[1])
+#define pio0 pio0_hw
+#define pio1 pio1_hw
+
+typedef struct pio_program {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+    uint8_t pio_version;
+} pio_program_t;
+
+typedef struct {
+    uint clkdiv;
+    uint wrap_target, wrap;
+    uint in_base, out_base, out_count, set_base, set_count, sideset_base, jmp_pin;
+    uint sideset_bit_count;
+    bool sideset_optional, sideset_pindirs;
+    bool in_shift_right, autopush, out_shift_right, autopull;
+    uint push_threshold, pull_threshold;
+    uint fifo_join;
+} pio_sm_config;
+
+enum pio_fifo_join { PIO_FIFO_JOIN_NONE = 0, PIO_FIFO_JOIN_TX = 1, PIO_FIFO_JOIN_RX = 2 };
+
+typedef enum pio_interrupt_source {
+    pis_sm0_rx_fifo_not_empty = 0,
+    pis_sm1_rx_fifo_not_empty = 1,
+    pis_sm2_rx_fifo_not_empty = 2,
+    pis_sm3_rx_fifo_not_empty = 3,
+    pis_sm0_tx_fifo_not_full = 4,
+    pis_sm1_tx_fifo_not_full = 5,
+    pis_sm2_tx_fifo_not_full = 6,
+    pis_sm3_tx_fifo_not_full = 7,
+    pis_interrupt0 = 8,
+    pis_interrupt1 = 9,
+    pis_interrupt2 = 10,
+    pis_interrupt3 = 11,
+} pio_interrupt_source_t;
+
+enum pio_src_dest { pio_pins = 0, pio_x = 1, pio_y = 2, pio_null = 3, pio_isr = 6, pio_osr = 7 };
+
+static inline uint pio_encode_jmp(uint addr) { return addr & 0x1f; }
+static inline uint pio_encode_set(enum pio_src_dest dest, uint value) { return 0xe000 | (dest << 5) | (value & 0x1f); }
+static inline uint pio_encode_pull(bool if_empty, bool block) { return 0x8080 | (if_empty << 6) | (block << 5); }
+static inline uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src) {
+    return 0xa000 | ((dest & 7) << 5) | (src & 7);
+}
+
+pio_sm_config pio_get_default_sm_config(void);
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap);
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base);
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count);
+void sm_config_set_set_pins(pio_sm_config *c, uint set_base, uint set_count);
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base);
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs);
+void sm_config_set_clkdiv(pio_sm_config *c, float div);
+void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac);
+void sm_config_set_jmp_pin(pio_sm_config *c, uint pin);
+void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold);
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold);
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join);
+
+uint pio_get_index(PIO pio);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+void pio_gpio_init(PIO pio, uint pin);
+bool pio_can_add_program(PIO pio, const pio_program_t *program);
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset);
+void pio_clear_instruction_memory(PIO pio);
+int pio_claim_unused_sm(PIO pio, bool required);
+void pio_sm_claim(PIO pio, uint sm);
+void pio_sm_unclaim(PIO pio, uint sm);
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_config(PIO pio, uint sm, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_restart(PIO pio, uint sm);
+void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac);
+void pio_clkdiv_restart_sm_mask(PIO pio, uint32_t mask);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+uint8_t pio_sm_get_pc(PIO pio, uint sm);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask);
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask);
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_full(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm);
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm);
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+
+void pio_interrupt_clear(PIO pio, uint pio_interrupt_num);
+bool pio_interrupt_get(PIO pio, uint pio_interrupt_num);
+void pio_set_irq0_source_enabled(PIO pio, pio_interrupt_source_t source, bool enabled);
+void pio_set_irq1_source_enabled(PIO pio, pio_interrupt_source_t source, bool enabled);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
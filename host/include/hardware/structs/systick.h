@@ -0,0 +1,28 @@
+#ifndef HOST_HARDWARE_STRUCTS_SYSTICK_H
+#define HOST_HARDWARE_STRUCTS_SYSTICK_H
+
+// Host stand-in for the SysTick registers. Every access goes through the simulator, which counts the current value
+// down on the system clock from the last write.
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    io_rw_32 csr;
+    io_rw_32 rvr;
+    io_rw_32 cvr;
+    io_ro_32 calib;
+} systick_hw_t;
+
+systick_hw_t *sim_systick_hw(void);
+
+#define systick_hw (sim_systick_hw())
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef HOST_HARDWARE_SYNC_H
+#define HOST_HARDWARE_SYNC_H
+
+// Host stand-in for the hardware spin locks and the sleep hint. The simulated cores never run at the same time, so
+// a lock is always free; only its cost is charged.
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NUM_SPIN_LOCKS 32
+
+typedef volatile uint32_t spin_lock_t;
+
+int spin_lock_claim_unused(bool required);
+void spin_lock_unclaim(uint lock_num);
+spin_lock_t *spin_lock_instance(uint lock_num);
+uint spin_lock_get_num(spin_lock_t *lock);
+uint32_t spin_lock_blocking(spin_lock_t *lock);
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq);
+void spin_lock_unsafe_blocking(spin_lock_t *lock);
+void spin_unlock_unsafe(spin_lock_t *lock);
+
+// On core1 outside a handler, parks the core: it only runs its interrupt handlers from then on
+void __wfi(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HOST_HARDWARE_TIMER_H
+#define HOST_HARDWARE_TIMER_H
+
+// Host stand-in for the microsecond timer, derived from the simulator clock.
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t time_us_32(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
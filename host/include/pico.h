@@ -0,0 +1,28 @@
+#ifndef HOST_PICO_H
+#define HOST_PICO_H
+
+// Host stand-in for the Pico SDK base header. Only what i2c_multi.c needs.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int uint;
+
+typedef volatile uint32_t io_rw_32;
+typedef const volatile uint32_t io_ro_32;
+
+#ifndef PICO_NO_HARDWARE
+#define PICO_NO_HARDWARE 0
+#endif
+
+#ifndef PICO_PIO_VERSION
+#define PICO_PIO_VERSION 0
+#endif
+
+// The functions placed in RAM on the chip go to their own section, the simulator charges the others as run from flash
+#define __not_in_flash_func(func) __attribute__((section("time_critical"))) func
+#define __time_critical_func(func) __not_in_flash_func(func)
+#define __force_inline inline __attribute__((always_inline))
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef HOST_PICO_MULTICORE_H
+#define HOST_PICO_MULTICORE_H
+
+// Host stand-in for the multicore API: core1 launch and the inter-core FIFOs, 8 words each way. The calls act on the
+// FIFOs of the core running the caller, as on the chip.
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Runs entry as core1 until its first __wfi(). core1 must not be running, reset it first to launch it again
+void multicore_launch_core1(void (*entry)(void));
+void multicore_reset_core1(void);
+
+bool multicore_fifo_rvalid(void);
+bool multicore_fifo_wready(void);
+void multicore_fifo_push_blocking_inline(uint32_t data);
+uint32_t multicore_fifo_pop_blocking(void);
+void multicore_fifo_drain(void);
+void multicore_fifo_clear_irq(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef HOST_PICO_STDIO_H
+#define HOST_PICO_STDIO_H
+
+// Host stand-in for the Pico SDK stdio. Raw output goes to the file set with sim_set_stdio(), stdout by default.
+
+#include <stdio.h>
+
+#include "pico.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int putchar_raw(int c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1338 @@
+#include "pio_sim.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/structs/systick.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "pico/multicore.h"
+#include "pico/stdio.h"
+
+// Rough Cortex-M0+ costs in system clock cycles. Every SDK accessor used by i2c_multi is an inlined one or two
+// instruction register access; the address computation around it is folded into the same figure. The library is
+// built with -fsanitize-coverage=trace-pc and the computation between the accesses is charged per basic block, an
+// average of three Thumb instructions and a taken branch. A block run by a handler outside the code placed in RAM
+// also pays an XIP cache line refill over QSPI at the default divider, as if every such block missed the cache. The
+// block count is that of the host compiler, so the figures are estimates meant for comparing revisions of the
+// library and placements, not the cycles of a given build for the chip.
+#define COST_ISR_ENTRY 16
+#define COST_ISR_EXIT 16
+#define COST_REG 4
+#define COST_POLL 6
+#define COST_BLOCK 4
+#define COST_XIP_MISS 56
+
+#define BLOCKING_TIMEOUT 10000000
+#define NUM_IRQS 32
+#define NUM_CORES 2
+#define SIO_FIFO_DEPTH 8
+#define MAX_SHARED_HANDLERS 4
+#define SPIN_LOCK_CLAIM_FIRST 24  // the SDK hands out 24 to 31, the lower ones are reserved
+
+typedef struct sim_sm_t {
+    bool claimed, enabled;
+    pio_sm_config config;
+    uint pc, delay, div_count;
+    uint32_t x, y, isr, osr;
+    uint isr_count, osr_count;
+    bool exec_pending, irq_waiting;
+    uint16_t exec_instr;
+    uint32_t tx[8], rx[8];
+    uint tx_level, rx_level;
+} sim_sm_t;
+
+typedef struct sim_pio_t {
+    uint16_t instr[PIO_INSTRUCTION_COUNT];
+    uint32_t used;
+    sim_sm_t sm[NUM_PIO_STATE_MACHINES];
+    uint8_t irq;
+    uint32_t inte[2];
+    uint32_t out_val, out_oe;
+} sim_pio_t;
+
+typedef struct sim_dma_t {
+    bool claimed, busy, irq_enabled[2];
+    dma_channel_config config;
+    uint32_t reload;
+} sim_dma_t;
+
+pio_hw_t sim_pio_hw[NUM_PIOS];
+dma_hw_t sim_dma_hw;
+
+static sim_pio_t pios[NUM_PIOS];
+static sim_dma_t dmas[NUM_DMA_CHANNELS];
+static uint8_t gpio_func[SIM_NUM_GPIOS];  // 0 = none, 1 = pio0, 2 = pio1
+static uint8_t gpio_oeover[SIM_NUM_GPIOS];
+static uint32_t ext_low, lines, sync[2], inputs;
+static bool contention;
+static uint64_t now;
+static uint32_t sys_hz = 125000000;
+static uint clkdiv_override;
+static sim_tick_hook_t tick_hook;
+static void *tick_context;
+static irq_handler_t irq_handlers[NUM_IRQS];
+static irq_handler_t irq_shared[NUM_IRQS][MAX_SHARED_HANDLERS];
+static bool irq_enabled[NUM_CORES][NUM_IRQS];
+static bool irq_pending[NUM_CORES][NUM_IRQS];  // set by software
+static bool in_isr[NUM_CORES];
+static bool irq_masked[NUM_CORES];  // PRIMASK, set while a spin lock is held
+static bool core1_running;          // launched and not reset since
+static bool flash_handlers;
+static uint core;                  // core running the code under test
+static uint64_t nested_cycles;     // handler cycles already charged, to leave out of a handler they ran within
+static uint32_t core0_load_period, core0_load_cycles;
+static uint32_t sio_fifo[NUM_CORES][SIO_FIFO_DEPTH];  // read side of each core
+static uint sio_level[NUM_CORES];
+static jmp_buf core1_park;
+static uint32_t spin_locks_claimed;
+static spin_lock_t spin_locks[NUM_SPIN_LOCKS];
+static sim_stats_t stats;
+static char fault[128];
+static FILE *trace;
+static bool has_fault;
+static FILE *stdio_file;
+static systick_hw_t systick;
+static uint32_t systick_cvr;   // value last seen by the code under test, any other value was written
+static uint64_t systick_base;  // cycle of the last write to CVR or enable
+
+static void dispatch_irqs(void);
+static void dma_tick(void);
+
+static inline uint pio_index(PIO pio) { return pio == pio1 ? 1 : 0; }
+
+static inline sim_pio_t *get_pio(PIO pio) { return &pios[pio_index(pio)]; }
+
+static void set_fault(const char *message) {
+    if (!has_fault) snprintf(fault, sizeof(fault), "%s at cycle %llu", message, (unsigned long long)now);
+    has_fault = true;
+    stats.faults++;
+}
+
+void sim_reset(uint32_t hz) {
+    memset(pios, 0, sizeof(pios));
+    memset(sim_pio_hw, 0, sizeof(sim_pio_hw));
+    memset(dmas, 0, sizeof(dmas));
+    memset(&sim_dma_hw, 0, sizeof(sim_dma_hw));
+    memset(gpio_func, 0, sizeof(gpio_func));
+    memset(gpio_oeover, 0, sizeof(gpio_oeover));
+    memset(irq_handlers, 0, sizeof(irq_handlers));
+    memset(irq_shared, 0, sizeof(irq_shared));
+    memset(irq_enabled, 0, sizeof(irq_enabled));
+    memset(irq_pending, 0, sizeof(irq_pending));
+    memset(in_isr, 0, sizeof(in_isr));
+    memset(irq_masked, 0, sizeof(irq_masked));
+    core1_running = false;
+    core = 0;
+    nested_cycles = 0;
+    core0_load_period = core0_load_cycles = 0;
+    memset(sio_level, 0, sizeof(sio_level));
+    spin_locks_claimed = 0;
+    for (uint i = 0; i < NUM_PIOS; i++)
+        for (uint j = 0; j < PIO_INSTRUCTION_COUNT; j++) pios[i].instr[j] = j;
+    ext_low = 0;
+    lines = sync[0] = sync[1] = inputs = (1u << SIM_NUM_GPIOS) - 1;
+    contention = false;
+    now = 0;
+    sys_hz = hz;
+    tick_hook = NULL;
+    tick_context = NULL;
+    has_fault = false;
+    fault[0] = 0;
+    memset(&systick, 0, sizeof(systick));
+    systick_cvr = 0;
+    systick_base = 0;
+    sim_clear_stats();
+}
+
+uint32_t sim_sys_hz(void) { return sys_hz; }
+
+uint64_t sim_now(void) { return now; }
+
+void sim_set_clkdiv_override(uint div) { clkdiv_override = div; }
+
+void sim_set_flash_handlers(bool enabled) { flash_handlers = enabled; }
+
+void sim_set_core0_load(uint32_t period, uint32_t cycles) {
+    core0_load_period = period;
+    core0_load_cycles = cycles;
+}
+
+void sim_set_trace(FILE *file) { trace = file; }
+
+void sim_set_tick_hook(sim_tick_hook_t hook, void *context) {
+    tick_hook = hook;
+    tick_context = context;
+}
+
+void sim_drive_low(uint gpio, bool low) {
+    if (low)
+        ext_low |= 1u << gpio;
+    else
+        ext_low &= ~(1u << gpio);
+}
+
+bool sim_line(uint gpio) { return lines & (1u << gpio); }
+
+bool sim_contention(void) { return contention; }
+
+const sim_stats_t *sim_get_stats(void) { return &stats; }
+
+void sim_clear_stats(void) { memset(&stats, 0, sizeof(stats)); }
+
+const char *sim_fault(void) { return has_fault ? fault : NULL; }
+
+/* ------------------------------------------------------------------------------------------------------------ */
+/* State machine core                                                                                           */
+/* ------------------------------------------------------------------------------------------------------------ */
+
+static inline uint tx_depth(const sim_sm_t *sm) {
+    return sm->config.fifo_join == PIO_FIFO_JOIN_TX ? 8 : sm->config.fifo_join == PIO_FIFO_JOIN_RX ? 0 : 4;
+}
+
+static inline uint rx_depth(const sim_sm_t *sm) {
+    return sm->config.fifo_join == PIO_FIFO_JOIN_RX ? 8 : sm->config.fifo_join == PIO_FIFO_JOIN_TX ? 0 : 4;
+}
+
+static bool tx_pop(sim_sm_t *sm, uint32_t *data) {
+    if (!sm->tx_level) return false;
+    *data = sm->tx[0];
+    memmove(sm->tx, sm->tx + 1, --sm->tx_level * sizeof(uint32_t));
+    return true;
+}
+
+static bool rx_push(sim_sm_t *sm, uint32_t data) {
+    if (sm->rx_level >= rx_depth(sm)) return false;
+    sm->rx[sm->rx_level++] = data;
+    return true;
+}
+
+static inline uint32_t rotate_inputs(uint base) {
+    return base ? (inputs >> base) | (inputs << (32 - base)) : inputs;
+}
+
+static void write_pins(sim_pio_t *p, uint base, uint count, uint32_t value, bool pindirs) {
+    for (uint i = 0; i < count; i++) {
+        uint pin = (base + i) % 32;
+        uint32_t bit = 1u << pin;
+        uint32_t *target = pindirs ? &p->out_oe : &p->out_val;
+        if (value & (1u << i))
+            *target |= bit;
+        else
+            *target &= ~bit;
+    }
+}
+
+static inline uint irq_index(uint sm, uint index) {
+    return (index & 0x10) ? ((index & 4) | ((index + sm) & 3)) : (index & 7);
+}
+
+static inline void advance_pc(sim_sm_t *sm) {
+    sm->pc = sm->pc == sm->config.wrap ? sm->config.wrap_target : (sm->pc + 1) % PIO_INSTRUCTION_COUNT;
+}
+
+static bool osr_refill(sim_sm_t *sm) {
+    uint32_t data;
+    if (!tx_pop(sm, &data)) return false;
+    sm->osr = data;
+    sm->osr_count = 0;
+    return true;
+}
+
+// Executes one instruction. Returns false if the instruction stalls.
+static bool execute(sim_pio_t *p, uint index, sim_sm_t *sm, uint16_t instr, bool *jumped) {
+    uint op = instr >> 13, arg1 = (instr >> 5) & 7, arg2 = instr & 0x1f;
+    uint sideset_bits = sm->config.sideset_bit_count;
+    uint field = (instr >> 8) & 0x1f;
+    if (sideset_bits) {
+        uint value = field >> (5 - sideset_bits);
+        bool enabled = true;
+        uint count = sideset_bits;
+        if (sm->config.sideset_optional) {
+            count--;
+            enabled = value & (1u << count);
+            value &= (1u << count) - 1;
+        }
+        if (enabled) write_pins(p, sm->config.sideset_base, count, value, sm->config.sideset_pindirs);
+    }
+    *jumped = false;
+    switch (op) {
+        case 0: {  // jmp
+            bool taken = false;
+            switch (arg1) {
+                case 0: taken = true; break;
+                case 1: taken = sm->x == 0; break;
+                case 2: taken = sm->x != 0; sm->x--; break;
+                case 3: taken = sm->y == 0; break;
+                case 4: taken = sm->y != 0; sm->y--; break;
+                case 5: taken = sm->x != sm->y; break;
+                case 6: taken = inputs & (1u << sm->config.jmp_pin); break;
+                case 7: taken = sm->osr_count < sm->config.pull_threshold; break;
+            }
+            if (taken) {
+                sm->pc = arg2;
+                *jumped = true;
+            }
+            return true;
+        }
+        case 1: {  // wait
+            bool polarity = instr & 0x80;
+            switch ((instr >> 5) & 3) {
+                case 0: return ((inputs >> arg2) & 1) == polarity;
+                case 1: return ((rotate_inputs(sm->config.in_base) >> arg2) & 1) == polarity;
+                case 2: {
+                    uint flag = irq_index(index, arg2);
+                    bool set = p->irq & (1u << flag);
+                    if (set != polarity) return false;
+                    if (polarity) p->irq &= ~(1u << flag);
+                    return true;
+                }
+                default: return true;
+            }
+        }
+        case 2: {  // in
+            uint count = arg2 ? arg2 : 32;
+            uint32_t mask = count == 32 ? 0xffffffff : (1u << count) - 1;
+            uint32_t data = 0;
+            switch (arg1) {
+                case 0: data = rotate_inputs(sm->config.in_base); break;
+                case 1: data = sm->x; break;
+                case 2: data = sm->y; break;
+                case 6: data = sm->isr; break;
+                case 7: data = sm->osr; break;
+            }
+            if (sm->config.autopush && sm->isr_count >= sm->config.push_threshold) {
+                if (!rx_push(sm, sm->isr)) return false;
+                sm->isr = 0;
+                sm->isr_count = 0;
+            }
+            data &= mask;
+            if (sm->config.in_shift_right)
+                sm->isr = count == 32 ? data : (sm->isr >> count) | (data << (32 - count));
+            else
+                sm->isr = count == 32 ? data : (sm->isr << count) | data;
+            sm->isr_count = sm->isr_count + count > 32 ? 32 : sm->isr_count + count;
+            if (sm->config.autopush && sm->isr_count >= sm->config.push_threshold && rx_push(sm, sm->isr)) {
+                sm->isr = 0;
+                sm->isr_count = 0;
+            }
+            return true;
+        }
+        case 3: {  // out
+            uint count = arg2 ? arg2 : 32;
+            if (sm->config.autopull && sm->osr_count >= sm->config.pull_threshold && !osr_refill(sm)) return false;
+            uint32_t data;
+            if (sm->config.out_shift_right) {
+                data = count == 32 ? sm->osr : sm->osr & ((1u << count) - 1);
+                sm->osr = count == 32 ? 0 : sm->osr >> count;
+            } else {
+                data = count == 32 ? sm->osr : sm->osr >> (32 - count);
+                sm->osr = count == 32 ? 0 : sm->osr << count;
+            }
+            sm->osr_count = sm->osr_count + count > 32 ? 32 : sm->osr_count + count;
+            switch (arg1) {
+                case 0: write_pins(p, sm->config.out_base, sm->config.out_count, data, false); break;
+                case 1: sm->x = data; break;
+                case 2: sm->y = data; break;
+                case 4: write_pins(p, sm->config.out_base, sm->config.out_count, data, true); break;
+                case 5:
+                    sm->pc = data & 0x1f;
+                    *jumped = true;
+                    break;
+                case 6:
+                    sm->isr = data;
+                    sm->isr_count = count;
+                    break;
+                case 7:
+                    sm->exec_pending = true;
+                    sm->exec_instr = data;
+                    break;
+            }
+            if (sm->config.autopull && sm->osr_count >= sm->config.pull_threshold) osr_refill(sm);
+            return true;
+        }
+        case 4: {
+            bool if_flag = instr & 0x40, block = instr & 0x20;
+            if (!(instr & 0x80)) {  // push
+                if (if_flag && sm->isr_count < sm->config.push_threshold) return true;
+                if (!rx_push(sm, sm->isr)) {
+                    if (block) return false;
+                }
+                sm->isr = 0;
+                sm->isr_count = 0;
+            } else {  // pull
+                if (if_flag && sm->osr_count < sm->config.pull_threshold) return true;
+                if (!osr_refill(sm)) {
+                    if (block) return false;
+                    sm->osr = sm->x;
+                    sm->osr_count = 0;
+                }
+            }
+            return true;
+        }
+        case 5: {  // mov
+            uint32_t data = 0;
+            switch (instr & 7) {
+                case 0: data = rotate_inputs(sm->config.in_base); break;
+                case 1: data = sm->x; break;
+                case 2: data = sm->y; break;
+                case 3: data = 0; break;
+                case 5: data = 0; break;
+                case 6: data = sm->isr; break;
+                case 7: data = sm->osr; break;
+            }
+            switch ((instr >> 3) & 3) {
+                case 1: data = ~data; break;
+                case 2: {
+                    uint32_t reversed = 0;
+                    for (uint i = 0; i < 32; i++)
+                        if (data & (1u << i)) reversed |= 1u << (31 - i);
+                    data = reversed;
+                    break;
+                }
+            }
+            switch (arg1) {
+                case 0: write_pins(p, sm->config.out_base, sm->config.out_count, data, false); break;
+                case 1: sm->x = data; break;
+                case 2: sm->y = data; break;
+                case 4:
+                    sm->exec_pending = true;
+                    sm->exec_instr = data;
+                    break;
+                case 5:
+                    sm->pc = data & 0x1f;
+                    *jumped = true;
+                    break;
+                case 6:
+                    sm->isr = data;
+                    sm->isr_count = 0;
+                    break;
+                case 7:
+                    sm->osr = data;
+                    sm->osr_count = 0;
+                    break;
+            }
+            return true;
+        }
+        case 6: {  // irq
+            uint flag = irq_index(index, arg2);
+            if (instr & 0x40) {
+                p->irq &= ~(1u << flag);
+                return true;
+            }
+            if (!(instr & 0x20)) {
+                p->irq |= 1u << flag;
+                return true;
+            }
+            if (!sm->irq_waiting) {
+                p->irq |= 1u << flag;
+                sm->irq_waiting = true;
+                return false;
+            }
+            if (p->irq & (1u << flag)) return false;
+            sm->irq_waiting = false;
+            return true;
+        }
+        default: {  // set
+            switch (arg1) {
+                case 0: write_pins(p, sm->config.set_base, sm->config.set_count, arg2, false); break;
+                case 1: sm->x = arg2; break;
+                case 2: sm->y = arg2; break;
+                case 4: write_pins(p, sm->config.set_base, sm->config.set_count, arg2, true); break;
+            }
+            return true;
+        }
+    }
+}
+
+static void sm_run_instruction(sim_pio_t *p, uint index, sim_sm_t *sm) {
+    bool from_exec = sm->exec_pending;
+    uint16_t instr = from_exec ? sm->exec_instr : p->instr[sm->pc];
+    uint pc = sm->pc;
+    bool jumped;
+    if (from_exec) sm->exec_pending = false;
+    bool completed = execute(p, index, sm, instr, &jumped);
+    if (trace)
+        fprintf(trace, "%10llu pio%u sm%u %c%2u %04x%s sda %u scl %u\n", (unsigned long long)now, (uint)(p - pios),
+                (uint)(sm - p->sm), from_exec ? 'x' : ' ', pc, instr, completed ? "" : " stall",
+                (lines >> sm->config.in_base) & 1, (lines >> (sm->config.in_base + 1)) & 1);
+    if (!completed) {
+        if (from_exec) {
+            sm->exec_pending = true;
+            sm->exec_instr = instr;
+        }
+        return;
+    }
+    bool out_exec = (instr & 0xe0e0) == 0x60e0;
+    if (!jumped && !from_exec) advance_pc(sm);
+    uint delay_bits = 5 - sm->config.sideset_bit_count;
+    sm->delay = out_exec ? 0 : ((instr >> 8) & 0x1f) & ((1u << delay_bits) - 1);
+}
+
+static void sm_tick(sim_pio_t *p, uint index, sim_sm_t *sm) {
+    uint div = clkdiv_override ? clkdiv_override : sm->config.clkdiv;
+    if (++sm->div_count < div) return;
+    sm->div_count = 0;
+    if (!sm->exec_pending && sm->delay) {
+        sm->delay--;
+        return;
+    }
+    sm_run_instruction(p, index, sm);
+}
+
+static uint32_t pio_intr(const sim_pio_t *p) {
+    uint32_t intr = (uint32_t)(p->irq & 0xf) << 8;
+    for (uint i = 0; i < NUM_PIO_STATE_MACHINES; i++) {
+        if (p->sm[i].rx_level) intr |= 1u << i;
+        if (p->sm[i].tx_level < tx_depth(&p->sm[i])) intr |= 1u << (4 + i);
+    }
+    return intr;
+}
+
+static void resolve_lines(void) {
+    uint32_t low = ext_low;
+    contention = false;
+    for (uint gpio = 0; gpio < SIM_NUM_GPIOS; gpio++) {
+        if (!gpio_func[gpio]) continue;
+        const sim_pio_t *p = &pios[gpio_func[gpio] - 1];
+        uint32_t bit = 1u << gpio;
+        bool oe = p->out_oe & bit;
+        switch (gpio_oeover[gpio]) {
+            case GPIO_OVERRIDE_INVERT: oe = !oe; break;
+            case GPIO_OVERRIDE_LOW: oe = false; break;
+            case GPIO_OVERRIDE_HIGH: oe = true; break;
+        }
+        if (!oe) continue;
+        if (p->out_val & bit) {
+            if (ext_low & bit) contention = true;
+        } else {
+            low |= bit;
+        }
+    }
+    lines = ((1u << SIM_NUM_GPIOS) - 1) & ~low;
+}
+
+void sim_step(void) {
+    now++;
+    if (tick_hook) tick_hook(tick_context);
+    resolve_lines();
+    inputs = sync[1];
+    sync[1] = sync[0];
+    sync[0] = lines;
+    for (uint i = 0; i < NUM_PIOS; i++)
+        for (uint j = 0; j < NUM_PIO_STATE_MACHINES; j++)
+            if (pios[i].sm[j].enabled) sm_tick(&pios[i], i, &pios[i].sm[j]);
+    dma_tick();
+    dispatch_irqs();
+}
+
+void sim_run(uint64_t cycles) {
+    while (cycles--) sim_step();
+}
+
+void sim_cpu_cycles(uint32_t cycles) {
+    while (cycles--) sim_step();
+}
+
+// Bounds of the functions marked __not_in_flash_func, placed in their own section by include/pico.h
+extern const char __start_time_critical[] __attribute__((weak));
+extern const char __stop_time_critical[] __attribute__((weak));
+
+void __sanitizer_cov_trace_pc(void) {
+    uintptr_t pc = (uintptr_t)__builtin_return_address(0);
+    bool in_ram = !flash_handlers && pc >= (uintptr_t)__start_time_critical && pc < (uintptr_t)__stop_time_critical;
+    sim_cpu_cycles(COST_BLOCK + (in_isr[core] && !in_ram ? COST_XIP_MISS : 0));
+}
+
+/* ------------------------------------------------------------------------------------------------------------ */
+/* Interrupts                                                                                                   */
+/* ------------------------------------------------------------------------------------------------------------ */
+
+static inline bool irq_ready(uint c, uint num) {
+    return irq_enabled[c][num] && (irq_handlers[num] || irq_has_shared_handler(num));
+}
+
+static int pending_irq(uint c) {
+    static const uint pio_irqs[NUM_PIOS][2] = {{PIO0_IRQ_0, PIO0_IRQ_1}, {PIO1_IRQ_0, PIO1_IRQ_1}};
+    for (uint num = 0; num < NUM_IRQS; num++)
+        if (irq_pending[c][num] && irq_ready(c, num)) return num;
+    if (irq_ready(c, DMA_IRQ_0) && sim_dma_hw.ints0) return DMA_IRQ_0;
+    if (irq_ready(c, DMA_IRQ_1) && sim_dma_hw.ints1) return DMA_IRQ_1;
+    for (uint i = 0; i < NUM_PIOS; i++) {
+        uint32_t intr = pio_intr(&pios[i]);
+        for (uint j = 0; j < 2; j++) {
+            uint num = pio_irqs[i][j];
+            if (irq_ready(c, num) && (intr & pios[i].inte[j])) return num;
+        }
+    }
+    // Raised while the core has words to read from the other one
+    if (irq_ready(c, SIO_IRQ_PROC0 + c) && sio_level[c]) return SIO_IRQ_PROC0 + c;
+    return -1;
+}
+
+static inline bool core0_loaded(void) { return core0_load_period && now % core0_load_period < core0_load_cycles; }
+
+static void dispatch_irqs(void) {
+    // core1 takes its interrupts also while core0 is in a handler. core0 waits for core1 to leave its handler, and for
+    // the end of its load window
+    for (uint c = NUM_CORES; c--;) {
+        int num;
+        while (!in_isr[c] && !irq_masked[c] && !(c == 0 && (in_isr[1] || core0_loaded())) &&
+               (num = pending_irq(c)) >= 0) {
+            uint caller = core;
+            uint64_t start = now, nested = nested_cycles;
+            core = c;
+            in_isr[c] = true;
+            irq_pending[c][num] = false;
+            stats.isr_count++;
+            sim_cpu_cycles(COST_ISR_ENTRY);
+            if (irq_handlers[num]) irq_handlers[num]();
+            for (uint i = 0; i < MAX_SHARED_HANDLERS; i++)
+                if (irq_shared[num][i]) irq_shared[num][i]();
+            sim_cpu_cycles(COST_ISR_EXIT);
+            // A core1 handler that ran within this one ran in parallel on the chip
+            uint64_t elapsed = now - start - (nested_cycles - nested);
+            stats.isr_cycles += elapsed;
+            nested_cycles += elapsed;
+            in_isr[c] = false;
+            core = caller;
+        }
+    }
+}
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) {
+    if (irq_has_shared_handler(num)) set_fault("exclusive handler on an IRQ with shared handlers");
+    irq_handlers[num] = handler;
+}
+
+irq_handler_t irq_get_exclusive_handler(uint num) { return irq_handlers[num]; }
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority) {
+    (void)order_priority;
+    if (irq_handlers[num]) set_fault("shared handler on an IRQ with an exclusive handler");
+    for (uint i = 0; i < MAX_SHARED_HANDLERS; i++) {
+        if (irq_shared[num][i]) continue;
+        irq_shared[num][i] = handler;
+        return;
+    }
+    set_fault("no free shared handler slot");
+}
+
+bool irq_has_shared_handler(uint num) {
+    for (uint i = 0; i < MAX_SHARED_HANDLERS; i++)
+        if (irq_shared[num][i]) return true;
+    return false;
+}
+
+void irq_remove_handler(uint num, irq_handler_t handler) {
+    if (irq_handlers[num] == handler) irq_handlers[num] = NULL;
+    for (uint i = 0; i < MAX_SHARED_HANDLERS; i++)
+        if (irq_shared[num][i] == handler) irq_shared[num][i] = NULL;
+}
+
+void irq_set_enabled(uint num, bool enabled) { irq_enabled[core][num] = enabled; }
+
+void irq_set_pending(uint num) {
+    sim_cpu_cycles(COST_REG);
+    irq_pending[core][num] = true;
+}
+
+/* ------------------------------------------------------------------------------------------------------------ */
+/* Multicore and spin locks                                                                                     */
+/* ------------------------------------------------------------------------------------------------------------ */
+
+void multicore_launch_core1(void (*entry)(void)) {
+    uint caller = core;
+    // core1 only takes an entry from the boot ROM, after power on or a reset
+    if (core1_running) set_fault("core1 launched without a reset");
+    core1_running = true;
+    sio_level[0] = 0;
+    // Run on core1 until it parks in __wfi(). The handlers it enabled are dispatched on core1 from then on
+    if (!setjmp(core1_park)) {
+        core = 1;
+        entry();
+    }
+    core = caller;
+}
+
+void multicore_reset_core1(void) {
+    core1_running = false;
+    memset(irq_enabled[1], 0, sizeof(irq_enabled[1]));
+    memset(irq_pending[1], 0, sizeof(irq_pending[1]));
+    sio_level[1] = 0;
+}
+
+void __wfi(void) {
+    if (core == 1 && !in_isr[1]) longjmp(core1_park, 1);
+    sim_cpu_cycles(1);
+}
+
+bool multicore_fifo_rvalid(void) {
+    sim_cpu_cycles(COST_REG);
+    return sio_level[core];
+}
+
+bool multicore_fifo_wready(void) {
+    sim_cpu_cycles(COST_REG);
+    return sio_level[!core] < SIO_FIFO_DEPTH;
+}
+
+void multicore_fifo_push_blocking_inline(uint32_t data) {
+    sim_cpu_cycles(COST_REG);
+    // The other core never runs while this one waits, a full FIFO would block forever
+    if (sio_level[!core] == SIO_FIFO_DEPTH) {
+        set_fault("push to a full inter-core FIFO");
+        return;
+    }
+    sio_fifo[!core][sio_level[!core]++] = data;
+}
+
+uint32_t multicore_fifo_pop_blocking(void) {
+    sim_cpu_cycles(COST_REG);
+    if (!sio_level[core]) {
+        set_fault("pop from an empty inter-core FIFO");
+        return 0;
+    }
+    uint32_t data = sio_fifo[core][0];
+    memmove(sio_fifo[core], sio_fifo[core] + 1, --sio_level[core] * sizeof(uint32_t));
+    return data;
+}
+
+void multicore_fifo_drain(void) {
+    sim_cpu_cycles(COST_REG);
+    sio_level[core] = 0;
+}
+
+void multicore_fifo_clear_irq(void) { sim_cpu_cycles(COST_REG); }
+
+int spin_lock_claim_unused(bool required) {
+    for (uint i = SPIN_LOCK_CLAIM_FIRST; i < NUM_SPIN_LOCKS; i++) {
+        if (spin_locks_claimed & (1u << i)) continue;
+        spin_locks_claimed |= 1u << i;
+        return i;
+    }
+    if (required) set_fault("no spin lock left");
+    return -1;
+}
+
+void spin_lock_unclaim(uint lock_num) { spin_locks_claimed &= ~(1u << lock_num); }
+
+spin_lock_t *spin_lock_instance(uint lock_num) { return &spin_locks[lock_num]; }
+
+uint spin_lock_get_num(spin_lock_t *lock) { return lock - spin_locks; }
+
+uint32_t spin_lock_blocking(spin_lock_t *lock) {
+    // Interrupts off on this core, then the lock register read until it returns non zero
+    (void)lock;
+    uint32_t saved_irq = irq_masked[core];
+    irq_masked[core] = true;
+    sim_cpu_cycles(2 * COST_REG);
+    return saved_irq;
+}
+
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq) {
+    (void)lock;
+    sim_cpu_cycles(COST_REG);
+    irq_masked[core] = saved_irq;
+}
+
+void spin_lock_unsafe_blocking(spin_lock_t *lock) {
+    // The lock register alone, interrupts are left as they are
+    (void)lock;
+    sim_cpu_cycles(COST_REG);
+}
+
+void spin_unlock_unsafe(spin_lock_t *lock) {
+    (void)lock;
+    sim_cpu_cycles(COST_REG);
+}
+
+/* ------------------------------------------------------------------------------------------------------------ */
+/* GPIO                                                                                                         */
+/* ------------------------------------------------------------------------------------------------------------ */
+
+void gpio_set_input_enabled(uint gpio, bool enabled) {
+    (void)gpio;
+    (void)enabled;
+    sim_cpu_cycles(COST_REG);
+}
+
+bool gpio_get(uint gpio) {
+    sim_cpu_cycles(COST_REG);
+    return inputs & (1u << gpio);
+}
+
+void gpio_set_oeover(uint gpio, uint value) {
+    sim_cpu_cycles(COST_REG);
+    gpio_oeover[gpio] = value;
+}
+
+/* ------------------------------------------------------------------------------------------------------------ */
+/* SDK PIO API                                                                                                  */
+/* ------------------------------------------------------------------------------------------------------------ */
+
+pio_sm_config pio_get_default_sm_config(void) {
+    pio_sm_config c;
+    memset(&c, 0, sizeof(c));
+    c.clkdiv = 1;
+    c.wrap = PIO_INSTRUCTION_COUNT - 1;
+    c.out_count = 32;
+    c.in_shift_right = true;
+    c.out_shift_right = true;
+    c.push_threshold = 32;
+    c.pull_threshold = 32;
+    return c;
+}
+
+void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap) {
+    c->wrap_target = wrap_target;
+    c->wrap = wrap;
+}
+
+void sm_config_set_in_pins(pio_sm_config *c, uint in_base) { c->in_base = in_base; }
+
+void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count) {
+    c->out_base = out_base;
+    c->out_count = out_count;
+}
+
+void sm_config_set_set_pins(pio_sm_config *c, uint set_base, uint set_count) {
+    c->set_base = set_base;
+    c->set_count = set_count;
+}
+
+void sm_config_set_sideset_pins(pio_sm_config *c, uint sideset_base) { c->sideset_base = sideset_base; }
+
+void sm_config_set_sideset(pio_sm_config *c, uint bit_count, bool optional, bool pindirs) {
+    c->sideset_bit_count = bit_count;
+    c->sideset_optional = optional;
+    c->sideset_pindirs = pindirs;
+}
+
+void sm_config_set_clkdiv(pio_sm_config *c, float div) { c->clkdiv = div < 1 ? 1 : (uint)div; }
+
+void sm_config_set_clkdiv_int_frac(pio_sm_config *c, uint16_t div_int, uint8_t div_frac) {
+    (void)div_frac;
+    c->clkdiv = div_int ? div_int : 65536;
+}
+
+void sm_config_set_jmp_pin(pio_sm_config *c, uint pin) { c->jmp_pin = pin; }
+
+void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush, uint push_threshold) {
+    c->in_shift_right = shift_right;
+    c->autopush = autopush;
+    c->push_threshold = push_threshold ? push_threshold : 32;
+}
+
+void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull, uint pull_threshold) {
+    c->out_shift_right = shift_right;
+    c->autopull = autopull;
+    c->pull_threshold = pull_threshold ? pull_threshold : 32;
+}
+
+void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join) { c->fifo_join = join; }
+
+uint pio_get_index(PIO pio) { return pio_index(pio); }
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    return (pio_index(pio) ? DREQ_PIO1_TX0 : DREQ_PIO0_TX0) + (is_tx ? 0 : 4) + sm;
+}
+
+void pio_gpio_init(PIO pio, uint pin) { gpio_func[pin] = pio_index(pio) + 1; }
+
+static int find_offset(sim_pio_t *p, const pio_program_t *program) {
+    uint32_t mask = program->length == 32 ? 0xffffffff : (1u << program->length) - 1;
+    if (program->origin >= 0) return (p->used & (mask << program->origin)) ? -1 : program->origin;
+    for (int offset = PIO_INSTRUCTION_COUNT - program->length; offset >= 0; offset--)
+        if (!(p->used & (mask << offset))) return offset;
+    return -1;
+}
+
+bool pio_can_add_program(PIO pio, const pio_program_t *program) { return find_offset(get_pio(pio), program) >= 0; }
+
+uint pio_add_program(PIO pio, const pio_program_t *program) {
+    sim_pio_t *p = get_pio(pio);
+    int offset = find_offset(p, program);
+    if (offset < 0) {
+        fprintf(stderr, "pio_sim: no program space for %u instructions\n", program->length);
+        set_fault("out of PIO instruction memory");
+        return 0;
+    }
+    for (uint i = 0; i < program->length; i++) {
+        uint16_t instr = program->instructions[i];
+        p->instr[offset + i] = (instr >> 13) == 0 ? instr + offset : instr;
+    }
+    p->used |= (program->length == 32 ? 0xffffffff : (1u << program->length) - 1) << offset;
+    return offset;
+}
+
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset) {
+    sim_pio_t *p = get_pio(pio);
+    p->used &= ~(((program->length == 32 ? 0xffffffff : (1u << program->length) - 1)) << loaded_offset);
+}
+
+void pio_clear_instruction_memory(PIO pio) {
+    sim_pio_t *p = get_pio(pio);
+    p->used = 0;
+    for (uint i = 0; i < PIO_INSTRUCTION_COUNT; i++) p->instr[i] = i;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+    sim_pio_t *p = get_pio(pio);
+    for (uint i = 0; i < NUM_PIO_STATE_MACHINES; i++) {
+        if (!p->sm[i].claimed) {
+            p->sm[i].claimed = true;
+            return i;
+        }
+    }
+    if (required) set_fault("no free state machine");
+    return -1;
+}
+
+void pio_sm_claim(PIO pio, uint sm) { get_pio(pio)->sm[sm].claimed = true; }
+
+void pio_sm_unclaim(PIO pio, uint sm) { get_pio(pio)->sm[sm].claimed = false; }
+
+static void sm_restart(sim_sm_t *sm) {
+    sm->isr = 0;
+    sm->isr_count = 0;
+    sm->osr_count = 32;
+    sm->delay = 0;
+    sm->exec_pending = false;
+    sm->irq_waiting = false;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config) {
+    sim_sm_t *s = &get_pio(pio)->sm[sm];
+    s->enabled = false;
+    s->config = *config;
+    s->tx_level = s->rx_level = 0;
+    sm_restart(s);
+    s->div_count = 0;
+    s->pc = initial_pc;
+    sim_cpu_cycles(8 * COST_REG);
+}
+
+void pio_sm_set_config(PIO pio, uint sm, const pio_sm_config *config) {
+    get_pio(pio)->sm[sm].config = *config;
+    sim_cpu_cycles(4 * COST_REG);
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    sim_cpu_cycles(2 * COST_REG);
+    get_pio(pio)->sm[sm].enabled = enabled;
+}
+
+void pio_sm_restart(PIO pio, uint sm) {
+    sim_cpu_cycles(COST_REG);
+    sm_restart(&get_pio(pio)->sm[sm]);
+}
+
+void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac) {
+    sim_cpu_cycles(COST_REG);
+    sm_config_set_clkdiv_int_frac(&get_pio(pio)->sm[sm].config, div_int, div_frac);
+}
+
+void pio_clkdiv_restart_sm_mask(PIO pio, uint32_t mask) {
+    sim_cpu_cycles(COST_REG);
+    sim_pio_t *p = get_pio(pio);
+    for (uint i = 0; i < NUM_PIO_STATE_MACHINES; i++)
+        if (mask & (1u << i)) p->sm[i].div_count = 0;
+}
+
+static void sm_exec(sim_pio_t *p, uint index, uint instr) {
+    sim_sm_t *s = &p->sm[index];
+    // Each write executes at once, so a previous one is not overwritten
+    if (s->exec_pending && s->enabled) sm_run_instruction(p, index, s);
+    s->delay = 0;
+    s->irq_waiting = false;
+    s->exec_pending = true;
+    s->exec_instr = instr;
+    if (!s->enabled) sm_run_instruction(p, index, s);
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr) {
+    sim_cpu_cycles(COST_REG);
+    sm_exec(get_pio(pio), sm, instr);
+}
+
+uint8_t pio_sm_get_pc(PIO pio, uint sm) {
+    sim_cpu_cycles(COST_REG);
+    return get_pio(pio)->sm[sm].pc;
+}
+
+// The SDK does these through forced set instructions, the result on the shared pin registers is the same
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask) {
+    (void)sm;
+    sim_cpu_cycles(4 * COST_REG);
+    sim_pio_t *p = get_pio(pio);
+    p->out_val = (p->out_val & ~pin_mask) | (pin_values & pin_mask);
+}
+
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask) {
+    (void)sm;
+    sim_cpu_cycles(4 * COST_REG);
+    sim_pio_t *p = get_pio(pio);
+    p->out_oe = (p->out_oe & ~pin_mask) | (pin_dirs & pin_mask);
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+    sim_cpu_cycles(COST_REG);
+    sim_sm_t *s = &get_pio(pio)->sm[sm];
+    if (s->tx_level >= tx_depth(s)) {
+        set_fault("TX FIFO overflow");
+        return;
+    }
+    s->tx[s->tx_level++] = data;
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+    sim_sm_t *s = &get_pio(pio)->sm[sm];
+    uint64_t start = now;
+    while (s->tx_level >= tx_depth(s)) {
+        if (now - start > BLOCKING_TIMEOUT) {
+            set_fault("pio_sm_put_blocking timed out");
+            return;
+        }
+        sim_cpu_cycles(COST_POLL);
+    }
+    pio_sm_put(pio, sm, data);
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) {
+    sim_cpu_cycles(COST_REG);
+    sim_sm_t *s = &get_pio(pio)->sm[sm];
+    if (!s->rx_level) return 0;
+    uint32_t data = s->rx[0];
+    memmove(s->rx, s->rx + 1, --s->rx_level * sizeof(uint32_t));
+    return data;
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm) {
+    sim_sm_t *s = &get_pio(pio)->sm[sm];
+    uint64_t start = now;
+    while (!s->rx_level) {
+        if (now - start > BLOCKING_TIMEOUT) {
+            set_fault("pio_sm_get_blocking timed out");
+            return 0;
+        }
+        sim_cpu_cycles(COST_POLL);
+    }
+    return pio_sm_get(pio, sm);
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+    sim_cpu_cycles(COST_REG);
+    return get_pio(pio)->sm[sm].rx_level == 0;
+}
+
+bool pio_sm_is_rx_fifo_full(PIO pio, uint sm) {
+    sim_cpu_cycles(COST_REG);
+    const sim_sm_t *s = &get_pio(pio)->sm[sm];
+    return s->rx_level >= rx_depth(s);
+}
+
+bool pio_sm_is_tx_fifo_empty(PIO pio, uint sm) {
+    sim_cpu_cycles(COST_REG);
+    return get_pio(pio)->sm[sm].tx_level == 0;
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) {
+    sim_cpu_cycles(COST_REG);
+    const sim_sm_t *s = &get_pio(pio)->sm[sm];
+    return s->tx_level >= tx_depth(s);
+}
+
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm) {
+    sim_cpu_cycles(COST_REG);
+    return get_pio(pio)->sm[sm].rx_level;
+}
+
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm) {
+    sim_cpu_cycles(COST_REG);
+    return get_pio(pio)->sm[sm].tx_level;
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm) {
+    sim_cpu_cycles(2 * COST_REG);
+    sim_sm_t *s = &get_pio(pio)->sm[sm];
+    s->tx_level = 0;
+    s->rx_level = 0;
+}
+
+void pio_interrupt_clear(PIO pio, uint pio_interrupt_num) {
+    sim_cpu_cycles(COST_REG);
+    get_pio(pio)->irq &= ~(1u << pio_interrupt_num);
+}
+
+bool pio_interrupt_get(PIO pio, uint pio_interrupt_num) {
+    sim_cpu_cycles(COST_REG);
+    return get_pio(pio)->irq & (1u << pio_interrupt_num);
+}
+
+static void set_irq_source(PIO pio, uint line, pio_interrupt_source_t source, bool enabled) {
+    sim_cpu_cycles(2 * COST_REG);
+    sim_pio_t *p = get_pio(pio);
+    if (enabled)
+        p->inte[line] |= 1u << source;
+    else
+        p->inte[line] &= ~(1u << source);
+}
+
+void pio_set_irq0_source_enabled(PIO pio, pio_interrupt_source_t source, bool enabled) {
+    set_irq_source(pio, 0, source, enabled);
+}
+
+void pio_set_irq1_source_enabled(PIO pio, pio_interrupt_source_t source, bool enabled) {
+    set_irq_source(pio, 1, source, enabled);
+}
+
+/* ------------------------------------------------------------------------------------------------------------ */
+/* DMA                                                                                                          */
+/* ------------------------------------------------------------------------------------------------------------ */
+
+static sim_sm_t *fifo_at(uintptr_t addr, bool tx) {
+    for (uint i = 0; i < NUM_PIOS; i++)
+        for (uint j = 0; j < NUM_PIO_STATE_MACHINES; j++)
+            if ((uintptr_t)(tx ? (void *)&sim_pio_hw[i].txf[j] : (void *)&sim_pio_hw[i].rxf[j]) == (addr & ~3ul))
+                return &pios[i].sm[j];
+    return NULL;
+}
+
+// SMx_INSTR written by DMA: the instruction is executed at once, like pio_sm_exec()
+static bool dma_write_instr(uintptr_t addr, uint32_t data) {
+    for (uint i = 0; i < NUM_PIOS; i++)
+        for (uint j = 0; j < NUM_PIO_STATE_MACHINES; j++)
+            if ((uintptr_t)&sim_pio_hw[i].sm[j].instr == (addr & ~3ul)) {
+                sm_exec(&pios[i], j, data & 0xffff);
+                return true;
+            }
+    return false;
+}
+
+static bool dreq_ready(uint dreq) {
+    if (dreq == DREQ_FORCE) return true;
+    if (dreq >= 16) return false;
+    sim_sm_t *sm = &pios[dreq / 8].sm[dreq % 4];
+    return (dreq % 8) < 4 ? sm->tx_level < tx_depth(sm) : sm->rx_level > 0;
+}
+
+static uintptr_t dma_advance(uintptr_t addr, uint size, bool ring, uint ring_bits) {
+    if (!ring || !ring_bits) return addr + size;
+    uintptr_t mask = ((uintptr_t)1 << ring_bits) - 1;
+    return (addr & ~mask) | ((addr + size) & mask);
+}
+
+static void dma_complete(uint channel) {
+    sim_dma_t *d = &dmas[channel];
+    d->busy = false;
+    if (!d->config.irq_quiet) {
+        if (d->irq_enabled[0]) sim_dma_hw.ints0 |= 1u << channel;
+        if (d->irq_enabled[1]) sim_dma_hw.ints1 |= 1u << channel;
+    }
+    if (d->config.chain_to != channel) dma_channel_start(d->config.chain_to);
+}
+
+static void dma_tick(void) {
+    for (uint channel = 0; channel < NUM_DMA_CHANNELS; channel++) {
+        sim_dma_t *d = &dmas[channel];
+        dma_channel_hw_t *hw = &sim_dma_hw.ch[channel];
+        if (!d->busy || !d->config.enable || !dreq_ready(d->config.dreq)) continue;
+        uint size = 1u << d->config.size;
+        uint32_t mask = size == 4 ? 0xffffffff : (1u << (8 * size)) - 1;
+        uint32_t data = 0;
+        sim_sm_t *rx = fifo_at(hw->read_addr, false);
+        if (rx) {
+            uint32_t word = 0;
+            if (rx->rx_level) {
+                word = rx->rx[0];
+                memmove(rx->rx, rx->rx + 1, --rx->rx_level * sizeof(uint32_t));
+            }
+            data = (word >> (8 * (hw->read_addr & 3))) & mask;
+        } else {
+            memcpy(&data, (const void *)hw->read_addr, size);
+        }
+        if (d->config.bswap && size > 1)
+            data = size == 2 ? (uint32_t)__builtin_bswap16(data) : __builtin_bswap32(data);
+        sim_sm_t *tx = fifo_at(hw->write_addr, true);
+        if (tx) {
+            uint32_t word = size == 4 ? data : size == 2 ? data * 0x10001u : data * 0x01010101u;
+            if (tx->tx_level < tx_depth(tx))
+                tx->tx[tx->tx_level++] = word;
+            else
+                set_fault("DMA TX FIFO overflow");
+        } else if (!dma_write_instr(hw->write_addr, data)) {
+            memcpy((void *)hw->write_addr, &data, size);
+        }
+        if (trace) fprintf(trace, "%10llu dma%u %08x\n", (unsigned long long)now, channel, data);
+        if (d->config.read_increment)
+            hw->read_addr = dma_advance(hw->read_addr, size, !d->config.ring_write, d->config.ring_size_bits);
+        if (d->config.write_increment)
+            hw->write_addr = dma_advance(hw->write_addr, size, d->config.ring_write, d->config.ring_size_bits);
+        if (--hw->transfer_count == 0) dma_complete(channel);
+    }
+}
+
+int dma_claim_unused_channel(bool required) {
+    for (uint i = 0; i < NUM_DMA_CHANNELS; i++) {
+        if (!dmas[i].claimed) {
+            dmas[i].claimed = true;
+            return i;
+        }
+    }
+    if (required) set_fault("no free DMA channel");
+    return -1;
+}
+
+void dma_channel_claim(uint channel) { dmas[channel].claimed = true; }
+
+void dma_channel_unclaim(uint channel) { dmas[channel].claimed = false; }
+
+bool dma_channel_is_claimed(uint channel) { return dmas[channel].claimed; }
+
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    dma_channel_config c;
+    memset(&c, 0, sizeof(c));
+    c.read_increment = true;
+    c.dreq = DREQ_FORCE;
+    c.chain_to = channel;
+    c.size = DMA_SIZE_32;
+    c.enable = true;
+    return c;
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) { c->read_increment = incr; }
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) { c->write_increment = incr; }
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq) { c->dreq = dreq; }
+
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to) { c->chain_to = chain_to; }
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) {
+    c->size = size;
+}
+
+void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits) {
+    c->ring_write = write;
+    c->ring_size_bits = size_bits;
+}
+
+void channel_config_set_bswap(dma_channel_config *c, bool bswap) { c->bswap = bswap; }
+
+void channel_config_set_irq_quiet(dma_channel_config *c, bool irq_quiet) { c->irq_quiet = irq_quiet; }
+
+void channel_config_set_enable(dma_channel_config *c, bool enable) { c->enable = enable; }
+
+void dma_channel_start(uint channel) {
+    sim_dma_t *d = &dmas[channel];
+    sim_dma_hw.ch[channel].transfer_count = d->reload;
+    d->busy = d->reload != 0;
+}
+
+void dma_channel_set_config(uint channel, const dma_channel_config *config, bool trigger) {
+    sim_cpu_cycles(COST_REG);
+    dmas[channel].config = *config;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger) {
+    sim_cpu_cycles(COST_REG);
+    sim_dma_hw.ch[channel].read_addr = (uintptr_t)read_addr;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_set_write_addr(uint channel, volatile void *write_addr, bool trigger) {
+    sim_cpu_cycles(COST_REG);
+    sim_dma_hw.ch[channel].write_addr = (uintptr_t)write_addr;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger) {
+    sim_cpu_cycles(COST_REG);
+    dmas[channel].reload = trans_count;
+    if (trigger) dma_channel_start(channel);
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint32_t transfer_count, bool trigger) {
+    dma_channel_set_read_addr(channel, read_addr, false);
+    dma_channel_set_write_addr(channel, write_addr, false);
+    dma_channel_set_trans_count(channel, transfer_count, false);
+    dma_channel_set_config(channel, config, trigger);
+}
+
+void dma_channel_abort(uint channel) {
+    sim_cpu_cycles(2 * COST_REG);
+    dmas[channel].busy = false;
+}
+
+bool dma_channel_is_busy(uint channel) {
+    sim_cpu_cycles(COST_REG);
+    return dmas[channel].busy;
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled) {
+    sim_cpu_cycles(2 * COST_REG);
+    dmas[channel].irq_enabled[0] = enabled;
+}
+
+void dma_channel_set_irq1_enabled(uint channel, bool enabled) {
+    sim_cpu_cycles(2 * COST_REG);
+    dmas[channel].irq_enabled[1] = enabled;
+}
+
+bool dma_channel_get_irq0_status(uint channel) {
+    sim_cpu_cycles(COST_REG);
+    return sim_dma_hw.ints0 & (1u << channel);
+}
+
+bool dma_channel_get_irq1_status(uint channel) {
+    sim_cpu_cycles(COST_REG);
+    return sim_dma_hw.ints1 & (1u << channel);
+}
+
+void dma_channel_acknowledge_irq0(uint channel) {
+    sim_cpu_cycles(COST_REG);
+    sim_dma_hw.ints0 &= ~(1u << channel);
+}
+
+void dma_channel_acknowledge_irq1(uint channel) {
+    sim_cpu_cycles(COST_REG);
+    sim_dma_hw.ints1 &= ~(1u << channel);
+}
+
+/* ------------------------------------------------------------------------------------------------------------ */
+/* SysTick                                                                                                      */
+/* ------------------------------------------------------------------------------------------------------------ */
+
+systick_hw_t *sim_systick_hw(void) {
+    sim_cpu_cycles(COST_REG);
+    // A write to CVR clears the counter, which reloads on the next cycle. Writes are only noticed on the next access
+    if (systick.cvr != systick_cvr || !(systick.csr & 1)) systick_base = now;
+    uint32_t reload = (systick.rvr & 0xFFFFFF) + 1;
+    systick.cvr = systick_cvr = (systick.csr & 1) ? reload - 1 - (uint32_t)((now - systick_base) % reload) : 0;
+    return &systick;
+}
+
+/* ------------------------------------------------------------------------------------------------------------ */
+/* Clocks, timer and stdio                                                                                      */
+/* ------------------------------------------------------------------------------------------------------------ */
+
+uint32_t clock_get_hz(enum clock_index clk_index) {
+    (void)clk_index;
+    return sys_hz;
+}
+
+uint32_t time_us_32(void) {
+    sim_cpu_cycles(COST_REG);
+    return (uint32_t)(now * 1000000 / sys_hz);
+}
+
+void sim_set_stdio(FILE *file) { stdio_file = file; }
+
+int putchar_raw(int c) { return fputc(c, stdio_file ? stdio_file : stdout); }
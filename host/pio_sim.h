@@ -0,0 +1,79 @@
+#ifndef PIO_SIM_H
+#define PIO_SIM_H
+
+// Cycle model of the RP2040 parts used by i2c_multi: both PIO blocks, the DMA channels, the GPIO input synchronisers,
+// open-drain bus lines with an external driver (the modelled master) and two Cortex-M0+ cores that take PIO, DMA and
+// inter-core FIFO interrupts.
+//
+// One call to sim_step() is one system clock cycle. CPU time is charged per hardware access and per basic block of the
+// library (see the cost table in pio_sim.c) plus exception entry and exit, and the PIO keeps running while the CPU is
+// busy, so interrupt latency shows up on the bus as clock stretching just like on the chip. Handler code outside the
+// functions placed in RAM is charged a flash cache miss per block.
+//
+// The code under test runs on core0. core1 runs the entry given to multicore_launch_core1() until its first __wfi()
+// and only takes interrupts from then on, also while core0 is in a handler. The time of a core1 handler is added to
+// the core0 handler it ran within, but left out of the statistics of the latter.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hardware/pio.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_NUM_GPIOS 30
+
+typedef struct sim_stats_t {
+    uint64_t isr_count;   // interrupt handler invocations
+    uint64_t isr_cycles;  // cycles spent in handlers, entry and exit included
+    uint64_t faults;      // blocking accesses that timed out
+} sim_stats_t;
+
+typedef void (*sim_tick_hook_t)(void *context);
+
+void sim_reset(uint32_t sys_hz);
+uint32_t sim_sys_hz(void);
+uint64_t sim_now(void);
+void sim_step(void);
+void sim_run(uint64_t cycles);
+
+// Charge CPU cycles to the code running on core0 (library or user handler). The rest of the chip keeps running.
+void sim_cpu_cycles(uint32_t cycles);
+
+// core0 does not take interrupts for the first cycles of every period, as with heavy USB or flash work. 0 disables it.
+void sim_set_core0_load(uint32_t period, uint32_t cycles);
+
+// Charge the library as if nothing were placed in RAM: every block a handler runs pays a flash cache miss
+void sim_set_flash_handlers(bool enabled);
+
+// Force every state machine to use this integer divider, whatever the library configures. 0 disables the override.
+void sim_set_clkdiv_override(uint div);
+
+// Log every executed state machine instruction and DMA transfer, NULL to stop. Stalled instructions are logged on
+// every retry.
+void sim_set_trace(FILE *file);
+
+// External bus driver. The hook runs once per cycle before the line levels are resolved.
+void sim_set_tick_hook(sim_tick_hook_t hook, void *context);
+void sim_drive_low(uint gpio, bool low);
+bool sim_line(uint gpio);
+
+// True while a line is driven high by a PIO and low by someone else
+bool sim_contention(void);
+
+// Output of putchar_raw(), NULL for stdout
+void sim_set_stdio(FILE *file);
+
+const sim_stats_t *sim_get_stats(void);
+void sim_clear_stats(void);
+
+// Last fault message, NULL if none
+const char *sim_fault(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+/**
+ * -------------------------------------------------------------------------------
+ *
+ * Copyright (c) 2022, Daniel Gorbea
+ * All rights reserved.
+ *
+ * This source code is licensed under the MIT-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ *
+ * -------------------------------------------------------------------------------
+ *
+ *  I2C slave multi - trace decoder
+ *
+ *  Prints the dumps written by i2c_multi_dump_trace() found in a capture of
+ *  the stdio output, a file or stdin. Other output around the dumps is skipped
+ *
+ * -------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "i2c_multi.h"
+
+#define MAGIC "I2CT"
+#define VERSION 1
+#define ENTRY_SIZE 8
+
+static bool read_bytes(FILE *file, uint8_t *buffer, uint length) { return fread(buffer, 1, length, file) == length; }
+
+static void print_entry(const uint8_t *entry, uint32_t *last) {
+    uint32_t time = entry[0] | entry[1] << 8 | entry[2] << 16 | (uint32_t)entry[3] << 24;
+    uint8_t type = entry[4], data = entry[5];
+    uint16_t length = entry[6] | entry[7] << 8;
+    if (last)
+        printf("%12u  %+8d  ", time, (int32_t)(time - *last));
+    else
+        printf("%12u  %8s  ", time, "");
+    switch (type) {
+        case I2C_TRACE_ADDRESS_ACK:
+        case I2C_TRACE_ADDRESS_NACK:
+            printf("address 0x%02X %s %s\n", data >> 1, data & 1 ? "read " : "write",
+                   type == I2C_TRACE_ADDRESS_ACK ? "ack" : "nack");
+            break;
+        case I2C_TRACE_ADDRESS_10BIT_ACK:
+        case I2C_TRACE_ADDRESS_10BIT_NACK:
+            printf("address 0x%03X 10-bit %s\n", length, type == I2C_TRACE_ADDRESS_10BIT_ACK ? "ack" : "nack");
+            break;
+        case I2C_TRACE_DATA: printf("data 0x%02X\n", data); break;
+        case I2C_TRACE_DATA_NACK: printf("data 0x%02X nack\n", data); break;
+        case I2C_TRACE_DATA_SENT: printf("data 0x%02X sent\n", data); break;
+        case I2C_TRACE_READ_NACK: printf("nack from the master after %u bytes\n", length); break;
+        case I2C_TRACE_REPEATED_START: printf("repeated start, %u bytes\n", length); break;
+        case I2C_TRACE_STOP: printf("stop, %u bytes\n", length); break;
+        default: printf("unknown type %u\n", type);
+    }
+}
+
+static bool decode(FILE *file, uint index) {
+    uint8_t header[4], entry[ENTRY_SIZE];
+    if (!read_bytes(file, header, sizeof(header))) return false;
+    if (header[0] != VERSION) {
+        printf("dump %u: version %u not supported\n", index, header[0]);
+        return false;
+    }
+    uint16_t count = header[2] | header[3] << 8;
+    printf("dump %u: %u entries\n%12s  %8s  %s\n", index, count, "time us", "delta", "event");
+    uint32_t last = 0;
+    for (uint i = 0; i < count; i++) {
+        if (!read_bytes(file, entry, sizeof(entry))) {
+            printf("truncated after %u entries\n", i);
+            return false;
+        }
+        print_entry(entry, i ? &last : NULL);
+        last = entry[0] | entry[1] << 8 | entry[2] << 16 | (uint32_t)entry[3] << 24;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    FILE *file = stdin;
+    if (argc > 2 || (argc == 2 && !strcmp(argv[1], "-h"))) {
+        printf("usage: %s [file]\n  decodes the i2c_multi_dump_trace() output in file, or stdin\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2 && !(file = fopen(argv[1], "rb"))) {
+        perror(argv[1]);
+        return 1;
+    }
+    // Find the magic byte by byte, the dumps may be mixed with text output
+    uint matched = 0, dumps = 0;
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        matched = (c == MAGIC[matched]) ? matched + 1 : (c == MAGIC[0]);
+        if (matched < strlen(MAGIC)) continue;
+        matched = 0;
+        if (dumps) printf("\n");
+        if (!decode(file, ++dumps)) break;
+    }
+    if (!dumps) printf("no trace found\n");
+    if (file != stdin) fclose(file);
+    return dumps ? 0 : 1;
+}
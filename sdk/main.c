@@ -16,19 +16,23 @@
  *
  *  Add external pull ups, 1k - 3.3k
  *
- *  Define handlers, write buffer and enable addresses
+ *  Define handlers, response buffers and enable addresses
  *
  * -------------------------------------------------------------------------------
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "i2c_multi.h"
 #include "pico/stdlib.h"
 
 PIO pio = pio0;
+i2c_multi_t *i2c_multi;
 uint pin = 0;
-uint8_t buffer[64] = {0};
+uint8_t buffer_70[] = {0x10, 0x11, 0x12};
+char buffer_71[64];
+uint64_t events[64];
 
 void i2c_receive_handler(uint8_t data, bool is_address) {
     if (is_address)
@@ -39,30 +43,22 @@ void i2c_receive_handler(uint8_t data, bool is_address) {
 
 void i2c_request_handler(uint8_t address) {
     printf("\nAddress: %X, request...", address);
-    switch (address) {
-        case 0x70:
-            buffer[0] = 0x10;
-            buffer[1] = 0x11;
-            buffer[2] = 0x12;
-            break;
-        case 0x71:
-            sprintf((char *)buffer, "Hello, I'm %X", address);
-            break;
-    }
 }
 
-void i2c_stop_handler(uint8_t length) { printf("\nTotal bytes: %u", length); }
+void i2c_stop_handler(uint32_t length) { printf("\nTotal bytes: %lu", (unsigned long)length); }
 
 int main() {
     stdio_init_all();
-    i2c_multi_init(pio, pin);
-    i2c_multi_enable_address(0x70);
-    i2c_multi_enable_address(0x71);
-    i2c_multi_set_receive_handler(i2c_receive_handler);
-    i2c_multi_set_request_handler(i2c_request_handler);
-    i2c_multi_set_stop_handler(i2c_stop_handler);
-    i2c_multi_set_write_buffer(buffer);
+    i2c_multi = i2c_multi_init(pio, pin);
+    i2c_multi_enable_address(i2c_multi, 0x70);
+    i2c_multi_enable_address(i2c_multi, 0x71);
+    i2c_multi_set_receive_handler(i2c_multi, i2c_receive_handler);
+    i2c_multi_set_request_handler(i2c_multi, i2c_request_handler);
+    i2c_multi_set_stop_handler(i2c_multi, i2c_stop_handler);
+    i2c_multi_set_event_queue(i2c_multi, events, 6);
+    sprintf(buffer_71, "Hello, I'm %X", 0x71);
+    i2c_multi_set_address_buffer(i2c_multi, 0x70, buffer_70, sizeof(buffer_70));
+    i2c_multi_set_address_buffer(i2c_multi, 0x71, (uint8_t *)buffer_71, strlen(buffer_71) + 1);
 
-    while (1)
-        ;
+    while (1) i2c_multi_task(i2c_multi);
 }